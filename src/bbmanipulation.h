@@ -1,12 +1,124 @@
 #ifndef BBMANIPULATION_H
 #define BBMANIPULATION_H
 
+#include <array>
+#include <cstdint>
 #include "chess.hpp"
 
-// returns the pawn attacks for a bitboard of pawns and color
-chess::Bitboard pawnAttacksBB(chess::Color C, chess::Bitboard pawns);
+// returns the directions a pawn of a color pushes and captures towards
+template <chess::Color::underlying C>
+constexpr chess::Direction up() {
+    return C == chess::Color::WHITE ? chess::Direction::NORTH : chess::Direction::SOUTH;
+}
 
-// returns the front span of a pawn 
-chess::Bitboard pawnFrontSpan(chess::Board board, chess::Square sq, chess::Color c);
+template <chess::Color::underlying C>
+constexpr chess::Direction down() {
+    return C == chess::Color::WHITE ? chess::Direction::SOUTH : chess::Direction::NORTH;
+}
 
-#endif
\ No newline at end of file
+template <chess::Color::underlying C>
+constexpr chess::Direction upWest() {
+    return C == chess::Color::WHITE ? chess::Direction::NORTH_WEST : chess::Direction::SOUTH_WEST;
+}
+
+template <chess::Color::underlying C>
+constexpr chess::Direction upEast() {
+    return C == chess::Color::WHITE ? chess::Direction::NORTH_EAST : chess::Direction::SOUTH_EAST;
+}
+
+// returns the pawn attacks for a bitboard of pawns of a color
+template <chess::Color::underlying C>
+constexpr chess::Bitboard pawnAttacksBB(chess::Bitboard pawns) {
+    return chess::attacks::shift<upWest<C>()>(pawns) | chess::attacks::shift<upEast<C>()>(pawns);
+}
+
+// returns the squares of a rank counted from a color's own side, 
+// where rank 0 is its back rank
+template <chess::Color::underlying C>
+constexpr chess::Bitboard relativeRankBB(int rank) {
+    return chess::Bitboard(0xFFULL << 8 * (C == chess::Color::WHITE ? rank : 7 - rank));
+}
+
+// ****************MASKS****************
+// Generated at compile time and indexed by file, or by color and square
+
+constexpr uint64_t FILE_A_BB = 0x0101010101010101ULL;
+
+// Squares of each file
+constexpr std::array<uint64_t, 8> make_file_masks() {
+    std::array<uint64_t, 8> masks{};
+    for (int f=0; f<8; f++) {
+        masks[f] = FILE_A_BB << f;
+    }
+    return masks;
+}
+
+inline constexpr std::array<uint64_t, 8> FILE_MASKS = make_file_masks();
+
+// Squares of the files next to each file
+constexpr std::array<uint64_t, 8> make_adjacent_files() {
+    std::array<uint64_t, 8> masks{};
+    for (int f=0; f<8; f++) {
+        masks[f] = (f > 0 ? FILE_MASKS[f - 1] : 0) | (f < 7 ? FILE_MASKS[f + 1] : 0);
+    }
+    return masks;
+}
+
+inline constexpr std::array<uint64_t, 8> ADJACENT_FILES = make_adjacent_files();
+
+// Squares of the ranks in front of a square, seen from a color, starting 
+// a given number of ranks ahead
+constexpr uint64_t ranks_ahead(int c, int sq, int from) {
+    int rank = sq / 8;
+    uint64_t mask = 0;
+    for (int r=0; r<8; r++) {
+        if (c == 0 ? r >= rank + from : r <= rank - from) {
+            mask |= 0xFFULL << (r * 8);
+        }
+    }
+    return mask;
+}
+
+typedef std::array<std::array<uint64_t, 64>, 2> SquareMasks;
+
+// Fills a table with the masks that f gives for each color and square
+template <typename F>
+constexpr SquareMasks make_square_masks(F f) {
+    SquareMasks masks{};
+    for (int c=0; c<2; c++) {
+        for (int sq=0; sq<64; sq++) {
+            masks[c][sq] = f(c, sq);
+        }
+    }
+    return masks;
+}
+
+// Squares in front of a square on its own file
+inline constexpr SquareMasks FORWARD_FILE = make_square_masks([](int c, int sq) {
+    return ranks_ahead(c, sq, 1) & FILE_MASKS[sq & 7];
+});
+
+// Squares an enemy pawn must not be on for a pawn to be passed
+/* These are the squares from which enemy pawns attack the front span. 
+    An enemy pawn diagonally in front of the pawn only attacks the pawn 
+    itself, so it does not count. */
+inline constexpr SquareMasks PASSED_PAWN_MASK = make_square_masks([](int c, int sq) {
+    return FORWARD_FILE[c][sq] | (ranks_ahead(c, sq, 2) & ADJACENT_FILES[sq & 7]);
+});
+
+// Squares around a king and the ones in front of those, seen from the 
+// king's own side of the board
+inline constexpr SquareMasks KING_ZONE = make_square_masks([](int c, int sq) {
+    uint64_t attacks = 0;
+    for (int dr=-1; dr<=1; dr++) {
+        for (int df=-1; df<=1; df++) {
+            int r = sq / 8 + dr, f = (sq & 7) + df;
+            if ((dr != 0 || df != 0) && r >= 0 && r < 8 && f >= 0 && f < 8) {
+                attacks |= 1ULL << (r * 8 + f);
+            }
+        }
+    }
+    return attacks | (c == 0 ? attacks << 8 : attacks >> 8);
+});
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include "chess.hpp"
+#include "search.h"
+#include "transposition.h"
+
+// Default settings used by "bench" when no arguments are given
+const int BENCH_DEPTH = 4;
+const int BENCH_HASH_MB = 16;
+const int BENCH_THREADS = 1;
+
+// Default number of passes over the positions made by "evalbench"
+const int EVAL_BENCH_ITERATIONS = 10000;
+
+// Searches every position of the built-in bench suite to a fixed depth and 
+// prints the total nodes, time and nodes per second. The node count is 
+// deterministic with a single thread and serves as a signature of the search.
+void Bench(int depth, int hashMb, int threads);
+
+// Evaluates the bench positions and every position one move away from them 
+// for a number of passes and prints the evaluations per second. The sum of 
+// all evaluations is printed as a signature of the evaluation function.
+void EvalBench(int iterations);
+
+#endif
@@ -0,0 +1,20 @@
+#include "evalcache.h"
+
+const uint64_t KEY_MASK = ~0xFFFFULL;
+
+EvalCache::EvalCache() : probes(0), hits(0), entries(EVAL_CACHE_SIZE, 0) {}
+
+bool EvalCache::probe(uint64_t key, int& eval) {
+    uint64_t entry = entries[key & (EVAL_CACHE_SIZE - 1)];
+    probes++;
+    if ((entry & KEY_MASK) == (key & KEY_MASK)) {
+        hits++;
+        eval = int16_t(entry & 0xFFFF);
+        return true;
+    }
+    return false;
+}
+
+void EvalCache::store(uint64_t key, int eval) {
+    entries[key & (EVAL_CACHE_SIZE - 1)] = (key & KEY_MASK) | uint16_t(eval);
+}
@@ -0,0 +1,31 @@
+#ifndef EVALCACHE_H
+#define EVALCACHE_H
+
+#include <cstdint>
+#include <vector>
+
+// Entries per cache, must be a power of two
+// The entry index supplies the low 16 bits of the key, so it is at least 65536
+const int EVAL_CACHE_SIZE = 65536;
+
+// Caches static evaluations by zobrist key
+/* Transpositions and the stand-pat of every quiescence node make the 
+    search evaluate the same positions many times. The stored eval is 
+    relative to the side to move, which is part of the key. */
+class EvalCache {
+    public:
+        EvalCache();
+
+        // Returns true and sets eval if the position is in the cache
+        bool probe(uint64_t key, int& eval);
+        void store(uint64_t key, int eval);
+
+        uint64_t probes;
+        uint64_t hits;
+
+    private:
+        // The upper 48 bits of the key and the eval as a 16-bit value
+        std::vector<uint64_t> entries;
+};
+
+#endif
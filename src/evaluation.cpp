@@ -1,4 +1,7 @@
+#include <climits>
 #include "evaluation.h"
+#include "position.h"
+#include "pawns.h"
 
 const int *PST[6] = {
     PAWN_PST,
@@ -9,15 +12,18 @@ const int *PST[6] = {
     KING_PST
 };
 
-const int ISOLANI_WEIGHT = 12;
-const int DOUBLED_WEIGHT = 18;
-const int WEAK_WEIGHT = 15;
-const int PASSED_PAWN_WEIGHT = 5;
+constexpr Score ISOLANI_WEIGHT = S(12, 12);
+constexpr Score DOUBLED_WEIGHT = S(18, 18);
+constexpr Score WEAK_WEIGHT = S(15, 15);
+constexpr Score PASSED_PAWN_WEIGHT = S(5, 5);
+
+// Weight of an attack on a square of the enemy king zone, by piece type
+constexpr int KING_ATTACK_WEIGHTS[6] = {0, 2, 2, 3, 5, 0};
 
 // Returns the endgame weight of a given position 
 // Endgame weight is indirectly proportional to the number of 
 // pieces left on the board
-int endgameWeight(chess::Board board) {
+int endgameWeight(const chess::Board& board) {
     int midgameLimit = 15258;
     int endgameLimit  = 3915;
     int nonPawnMaterial = 0;
@@ -32,29 +38,19 @@ int endgameWeight(chess::Board board) {
 
 // Evaluates a position relative to a certain side based on the 
 // material count and the Piece-Square Tables
-int material_count(chess::Board board, chess::Color c, bool endgame) {
+template <chess::Color::underlying C>
+int material_count(const chess::Board& board, bool endgame) {
     int eval = 0;
     for (int p=(int)chess::PieceType::PAWN; p<=(int)chess::PieceType::KING; p++) {
-        chess::Bitboard pieces = board.pieces(PIECETYPES[p], c);
+        chess::Bitboard pieces = board.pieces(PIECETYPES[p], C);
         while (pieces) {
-            chess::Square square = pieces.pop();
+            int square = pieces.pop();
+            int idx = (C == chess::Color::WHITE ? FLIP[square] : square);
             eval += PIECE_VALUES[p];
-            if (c == chess::Color::WHITE) {
-                if (p==KING && endgame) {
-                    eval += KING_EG_PST[FLIP[square.index()]];
-                } else if (p==QUEEN && endgame) {
-                    eval += PST[p][FLIP[square.index()]];
-                } else if (p!=QUEEN) {
-                    eval += PST[p][FLIP[square.index()]];
-                }
-            } else {
-                if (p==KING && endgame) {
-                    eval += KING_EG_PST[square.index()];
-                } else if (p==QUEEN && endgame) {
-                    eval += PST[p][square.index()];
-                } else if (p!=QUEEN) {
-                    eval += PST[p][square.index()];
-                }
+            if (p==KING && endgame) {
+                eval += KING_EG_PST[idx];
+            } else if (p!=QUEEN || endgame) {
+                eval += PST[p][idx];
             }
         }
     }
@@ -65,23 +61,14 @@ int material_count(chess::Board board, chess::Color c, bool endgame) {
 /* A pawn is considered to be an isolani when: 
     - There are no friendly pawns on the adjacent files
 */
-int get_isolanis(chess::Board board, chess::Color c) {
+template <chess::Color::underlying C>
+int get_isolanis(const chess::Board& board) {
     int count = 0;
-    chess::Bitboard pawns = board.pieces(chess::PieceType::PAWN, c);
-    while (pawns) {
-        int square = pawns.pop();
-        int file = square & 7;
-        if (file != 0) {
-            if (board.pieces(chess::PieceType::PAWN, c) & (0x0101010101010101 << (file - 1))) {
-                continue; 
-            }
-        }
-        if (file != 7) {
-            if (board.pieces(chess::PieceType::PAWN, c) & (0x0101010101010101 << (file + 1))) {
-                continue; 
-            }
+    chess::Bitboard pawns = board.pieces(chess::PieceType::PAWN, C);
+    for (int file=0; file<8; file++) {
+        if (!(pawns & ADJACENT_FILES[file])) {
+            count += (pawns & FILE_MASKS[file]).count();
         }
-        count++;
     }
     return count;
 }
@@ -90,12 +77,12 @@ int get_isolanis(chess::Board board, chess::Color c) {
 /* A group of pawns are said to be doubled when:
     - There are two or more of them in the same file 
 */
-int get_doubled(chess::Board board, chess::Color c) {
+template <chess::Color::underlying C>
+int get_doubled(const chess::Board& board) {
     int count = 0;
-    chess::Bitboard pawns = board.pieces(chess::PieceType::PAWN, c);
+    chess::Bitboard pawns = board.pieces(chess::PieceType::PAWN, C);
     for (int i=0; i<8; i++) {
-        chess::Bitboard file = (0x0101010101010101 << i);
-        int onFile = (file & pawns).count();
+        int onFile = (pawns & FILE_MASKS[i]).count();
         if (onFile >= 2) {
             count += onFile - 1;
         }
@@ -111,88 +98,105 @@ int get_doubled(chess::Board board, chess::Color c) {
     - A pawn cannot be pushed to defend it
     - A pawn cannot be double-pushed to defend it
 */
-int get_weak(chess::Board board, chess::Color c) {
-    chess::Color other = ~c;
+template <chess::Color::underlying C>
+int get_weak(const chess::Board& board) {
     // Calculate Weak Pawns 
-    chess::Bitboard weakPawns = board.pieces(chess::PieceType::PAWN, c);
-    chess::Bitboard pawnAttacks = pawnAttacksBB(c, weakPawns);
+    constexpr chess::Direction Up = up<C>();
+    constexpr chess::Direction Down = down<C>();
+    chess::Bitboard pawns = board.pieces(chess::PieceType::PAWN, C);
+    chess::Bitboard pawnAttacks = pawnAttacksBB<C>(pawns);
     chess::Bitboard allPawns = board.pieces(chess::PieceType::PAWN);
-    weakPawns &= ~pawnAttacks;
-    weakPawns &= ~((pawnAttacks & ~allPawns) >> 8);
-    weakPawns &= ~(((pawnAttacks & ~allPawns & ~(allPawns << 8)) >> 16) & (chess::Bitboard)chess::Rank::RANK_2);
-    chess::Bitboard pawnStep1 = (board.pieces(chess::PieceType::PAWN, c) << 8) & ~allPawns;
-    chess::Bitboard pawnStep2 = (pawnStep1 << 8) & ~allPawns & (chess::Bitboard)chess::Rank::RANK_4;
-    weakPawns &=  ~pawnAttacksBB(c, pawnStep1 | pawnStep2);
+    chess::Bitboard defendedSquares = pawnAttacks & ~allPawns;
+    chess::Bitboard weakPawns = pawns & ~pawnAttacks;
+    weakPawns &= ~chess::attacks::shift<Down>(defendedSquares);
+    weakPawns &= ~(chess::attacks::shift<Down>(chess::attacks::shift<Down>(defendedSquares & ~chess::attacks::shift<Up>(allPawns))) & relativeRankBB<C>(1));
+    chess::Bitboard pawnStep1 = chess::attacks::shift<Up>(pawns) & ~allPawns;
+    chess::Bitboard pawnStep2 = chess::attacks::shift<Up>(pawnStep1) & ~allPawns & relativeRankBB<C>(3);
+    weakPawns &=  ~pawnAttacksBB<C>(pawnStep1 | pawnStep2);
     return weakPawns.count();
 }
 
-// Checks if a pawn on a given square is a passed pawn
+// Returns the passed pawns of a given color in a position
 /* A pawn is considered a passer when:
     - Its front span is not attacked by any enemy pawns
     - There are no pawns of either color in the squares in front of it
 */
-bool passer(chess::Board board, chess::Square sq) {
-    chess::Color c = board.at(sq).color();
-    chess::Color other = ~c;
-    chess::Bitboard otherPawns = board.pieces(chess::PieceType::PAWN, other);
-    chess::Bitboard otherPawnsAttacks = pawnAttacksBB(other, otherPawns);
+template <chess::Color::underlying C>
+chess::Bitboard passed_pawns(const chess::Board& board) {
+    constexpr chess::Color Us = C;
+    chess::Bitboard passed = 0;
+    chess::Bitboard pawns = board.pieces(chess::PieceType::PAWN, Us);
+    chess::Bitboard otherPawns = board.pieces(chess::PieceType::PAWN, ~Us);
     chess::Bitboard allPawns = board.pieces(chess::PieceType::PAWN);
-    chess::Bitboard pFrontSpan = pawnFrontSpan(board, sq, c);
-    return (!(otherPawnsAttacks & pFrontSpan) && !(allPawns & pFrontSpan));
-}
-
-// Returns the number of passed pawns of a given color in a position
-int get_passed(chess::Board board, chess::Color c) {
-    int count = 0;
-    chess::Bitboard pawns = board.pieces(chess::PieceType::PAWN, c);
     while (pawns) {
         int square = pawns.pop();
-        if (passer(board, chess::Square(square))) {
-            count++;
+        if (!(otherPawns & PASSED_PAWN_MASK[Us][square]) && !(allPawns & FORWARD_FILE[Us][square])) {
+            passed |= chess::Bitboard(1ULL << square);
         }
     }
-    return count;
+    return passed;
+}
+
+// Fills in the pawn structure terms of a position
+void evaluate_pawns(const chess::Board& board, PawnEntry& entry) {
+    Score score = S(0, 0);
+    score -= ISOLANI_WEIGHT * (get_isolanis<chess::Color::WHITE>(board) - get_isolanis<chess::Color::BLACK>(board));
+    score -= WEAK_WEIGHT * (get_weak<chess::Color::WHITE>(board) - get_weak<chess::Color::BLACK>(board));
+    score -= DOUBLED_WEIGHT * (get_doubled<chess::Color::WHITE>(board) - get_doubled<chess::Color::BLACK>(board));
+    entry.passed[0] = passed_pawns<chess::Color::WHITE>(board);
+    entry.passed[1] = passed_pawns<chess::Color::BLACK>(board);
+    entry.attacks[0] = pawnAttacksBB<chess::Color::WHITE>(board.pieces(chess::PieceType::PAWN, chess::Color::WHITE));
+    entry.attacks[1] = pawnAttacksBB<chess::Color::BLACK>(board.pieces(chess::PieceType::PAWN, chess::Color::BLACK));
+    score += PASSED_PAWN_WEIGHT * (entry.passed[0].count() - entry.passed[1].count());
+    entry.score = score;
+}
+
+// Fills in the pawn attacks and the king zone of a color
+template <chess::Color::underlying C>
+void init_eval_info(const chess::Board& board, const PawnEntry& pawns, EvalInfo& ei) {
+    constexpr chess::Color Us = C;
+    ei.pawnAttacks[Us] = pawns.attacks[Us];
+    ei.kingZone[Us] = KING_ZONE[Us][board.kingSq(Us).index()];
+    ei.kingAttackWeight[Us] = 0;
 }
 
 // Returns the mobility score for a given color in a position
 // Value decreases in significance in the endgame
-int mobility(chess::Board board, chess::Color c) {
-    int count = 0;
-    for (int sq=0; sq<64; sq++) {
-        chess::Square square = chess::Square(sq);
-        chess::Piece piece = board.at(square);
-        if (piece.color() == c) {
-            chess::PieceType p = piece.type();
+/* Squares occupied by the color's own king or pawns or attacked by enemy 
+    pawns do not count. While walking the pieces, their attacks on the 
+    enemy king zone are weighted for king_safety(), so mobility() has to 
+    run for both colors first. */
+template <chess::Color::underlying C>
+Score mobility(const chess::Board& board, EvalInfo& ei) {
+    constexpr chess::Color c = C;
+    constexpr chess::Color opp = ~c;
+    Score count = S(0, 0);
+    chess::Bitboard mobilityArea = ~(board.pieces(chess::PieceType::KING, c) | board.pieces(chess::PieceType::PAWN, c) | ei.pawnAttacks[opp]);
+    for (int p=KNIGHT; p<=QUEEN; p++) {
+        chess::Bitboard pieces = board.pieces(PIECETYPES[p], c);
+        while (pieces) {
+            chess::Square sq = pieces.pop();
             chess::Bitboard attacks;
-            if (p == chess::PieceType::KNIGHT) {
+            if (p == KNIGHT) {
                 attacks = chess::attacks::knight(sq);
-            } else if (p == chess::PieceType::BISHOP) {
+            } else if (p == BISHOP) {
                 attacks = chess::attacks::bishop(sq, board.occ());
-            } else if (p == chess::PieceType::ROOK) {
+            } else if (p == ROOK) {
                 attacks = chess::attacks::rook(sq, board.occ());
-            } else if (p == chess::PieceType::QUEEN) {
-                attacks = chess::attacks::queen(sq, board.occ());
             } else {
-                continue;
-            }
-            attacks &= ~(board.pieces(chess::PieceType::KING, c) | board.pieces(chess::PieceType::PAWN, c));
-            chess::Bitboard otherPawns = board.pieces(chess::PieceType::PAWN, ~c);
-            if (c == chess::Color::WHITE) {
-                attacks &= ~(chess::attacks::shift<chess::Direction::SOUTH_EAST>(otherPawns));
-                attacks &= ~(chess::attacks::shift<chess::Direction::SOUTH_WEST>(otherPawns));
-            } else if (c == chess::Color::BLACK) {
-                attacks &= ~(chess::attacks::shift<chess::Direction::NORTH_EAST>(otherPawns));
-                attacks &= ~(chess::attacks::shift<chess::Direction::NORTH_WEST>(otherPawns));
+                attacks = chess::attacks::queen(sq, board.occ());
             }
+            ei.kingAttackWeight[opp] += KING_ATTACK_WEIGHTS[p] * (attacks & ei.kingZone[opp]).count();
 
-            if (p == chess::PieceType::KNIGHT) {
-                count += knightMob[attacks.count()];
-            } else if (p == chess::PieceType::BISHOP) {
-                count += bishopMob[attacks.count()];
-            } else if (p == chess::PieceType::ROOK) {
-                count += rookMob[attacks.count()];
-            } else { // queen
-                count += queenMob[attacks.count()];
+            int moves = (attacks & mobilityArea).count();
+            if (p == KNIGHT) {
+                count += knightMob[moves];
+            } else if (p == BISHOP) {
+                count += bishopMob[moves];
+            } else if (p == ROOK) {
+                count += rookMob[moves];
+            } else {
+                count += queenMob[moves];
             }
         }
     }
@@ -201,37 +205,21 @@ int mobility(chess::Board board, chess::Color c) {
 
 // Returns the king safety score for a given color in a position
 // Value decreases in significance in the endgame
-int king_safety(chess::Board board, chess::Color c) {
-    int count = 0;
-    chess::Color opp = ~c;
-    int up = (c == chess::Color::WHITE ? 8 : -8);
-    chess::Square kingSquare = board.kingSq(c);
-    chess::Bitboard kingZone = chess::attacks::king(kingSquare) | (chess::attacks::king(kingSquare) << up);
-    while (kingZone) {
-        chess::Square square = kingZone.pop();
-        chess::Bitboard attackers = chess::attacks::attackers(board, opp, square);
-        while (attackers) {
-            chess::Square attackSq = attackers.pop();
-            chess::PieceType p = board.at<chess::PieceType>(attackSq);
-            if (p==chess::PieceType::KNIGHT || p==chess::PieceType::BISHOP) {
-                count += 2;
-            } else if (p==chess::PieceType::ROOK) {
-                count += 3;
-            } else if (p==chess::PieceType::QUEEN) {
-                count += 5;
-            }
-        }
-    }
-    return -safetyTable[count];
+/* Every attack of an enemy piece on a square of the king zone adds its 
+    KING_ATTACK_WEIGHTS value, summed up by mobility(). */
+template <chess::Color::underlying C>
+Score king_safety(const EvalInfo& ei) {
+    return -safetyTable[std::min(ei.kingAttackWeight[chess::Color(C)], 99)];
 }
 
 // Special king endgame evaluation to force opponent kings to corner
 // This makes it easy to later deliver checkmate, as without it
 // The computer hopelessly shuffles pieces around
-int king_endgame_eval(chess::Board board, chess::Color c, int endgameWeight) {
+template <chess::Color::underlying C>
+int king_endgame_eval(const chess::Board& board, int endgameWeight) {
+    constexpr chess::Color oppColor = ~chess::Color(C);
     int eval = 0;
-    chess::Color oppColor = ~c;
-    chess::Square kingSq = board.kingSq(c);
+    chess::Square kingSq = board.kingSq(C);
     chess::Square oppKingSq = board.kingSq(oppColor);
 
     // Favour positions where opponent king is far away from centre
@@ -253,22 +241,60 @@ int king_endgame_eval(chess::Board board, chess::Color c, int endgameWeight) {
     return eval*endgameWeight/10;
 }
 
+// Blends the middlegame and endgame values of a score by the endgame weight
+int taper(Score score, int egWeight) {
+    return ((mg_value(score) * (128 - egWeight)) + (eg_value(score) * egWeight)) / 128;
+}
+
 // Returns the evaluation for a given position
-int evaluate(chess::Board board) {
-    int endgameScore = material_count(board, chess::Color::WHITE, true) - material_count(board, chess::Color::BLACK, true);
-    int middlegameScore = material_count(board, chess::Color::WHITE, false) - material_count(board, chess::Color::BLACK, false);
+/* Uses the network when the NNUE evaluation is in use. Otherwise all 
+    terms are added up as Scores and blended between the middlegame and 
+    the endgame once at the end. The king endgame term is already scaled by 
+    the endgame weight, so it is added after the blend. */
+int evaluate(const Position& board, PawnTable& pawnTable, int alpha, int beta, bool& lazy) {
+    lazy = false;
+    if (UsingNNUE()) {
+        return EvaluateNNUE(board);
+    }
+#ifdef DEBUG_EVAL
+    // The incrementally updated scores must match a full recompute
+    assert(board.materialMg(chess::Color::WHITE) == material_count<chess::Color::WHITE>(board, false));
+    assert(board.materialEg(chess::Color::WHITE) == material_count<chess::Color::WHITE>(board, true));
+    assert(board.materialMg(chess::Color::BLACK) == material_count<chess::Color::BLACK>(board, false));
+    assert(board.materialEg(chess::Color::BLACK) == material_count<chess::Color::BLACK>(board, true));
+#endif
+    Score score = board.psqScore(chess::Color::WHITE) - board.psqScore(chess::Color::BLACK);
     int egWeight = endgameWeight(board);
-    int eval = ((middlegameScore * (128 - egWeight)) + (endgameScore * egWeight)) / 128;
-    eval -= ISOLANI_WEIGHT * (get_isolanis(board, chess::Color::WHITE) - get_isolanis(board, chess::Color::BLACK));
-    eval -= WEAK_WEIGHT * (get_weak(board, chess::Color::WHITE) - get_weak(board, chess::Color::BLACK));
-    eval -= DOUBLED_WEIGHT * (get_doubled(board, chess::Color::WHITE) - get_doubled(board, chess::Color::BLACK));
-    eval += PASSED_PAWN_WEIGHT * (get_passed(board, chess::Color::WHITE) - get_passed(board, chess::Color::BLACK));
-    if (!egWeight>115) { // if we are in the endgame, mobility and safety scores don't matter much
-        eval += (mobility(board, chess::Color::WHITE) - mobility(board, chess::Color::BLACK));
-        eval += (king_safety(board, chess::Color::WHITE) - king_safety(board, chess::Color::BLACK));
-    } else {
-        egWeight *= 2;
+    int kingWeight = egWeight <= 115 ? egWeight : egWeight * 2;
+    int kingEval = king_endgame_eval<chess::Color::WHITE>(board, kingWeight) - king_endgame_eval<chess::Color::BLACK>(board, kingWeight);
+
+    // Lazy exit before the pawn, mobility and king safety terms
+    int lazyEval = taper(score, egWeight) + kingEval;
+    lazyEval = (board.sideToMove() == chess::Color::WHITE ? lazyEval : -lazyEval);
+    if (lazyEval - LAZY_MARGIN >= beta || lazyEval + LAZY_MARGIN <= alpha) {
+        lazy = true;
+        return lazyEval;
     }
-    eval += king_endgame_eval(board, chess::Color::WHITE, egWeight) - king_endgame_eval(board, chess::Color::BLACK, egWeight);
+
+    const PawnEntry& pawns = pawnTable.probe(board);
+#ifdef DEBUG_EVAL
+    PawnEntry fresh;
+    evaluate_pawns(board, fresh);
+    assert(pawns.score == fresh.score);
+#endif
+    score += pawns.score;
+    if (egWeight <= 115) { // if we are in the endgame, mobility and safety scores don't matter much
+        EvalInfo ei;
+        init_eval_info<chess::Color::WHITE>(board, pawns, ei);
+        init_eval_info<chess::Color::BLACK>(board, pawns, ei);
+        score += (mobility<chess::Color::WHITE>(board, ei) - mobility<chess::Color::BLACK>(board, ei));
+        score += (king_safety<chess::Color::WHITE>(ei) - king_safety<chess::Color::BLACK>(ei));
+    }
+    int eval = taper(score, egWeight) + kingEval;
     return (board.sideToMove() == chess::Color::WHITE ? eval : -eval);
 }
+
+int evaluate(const Position& board, PawnTable& pawnTable) {
+    bool lazy;
+    return evaluate(board, pawnTable, INT_MIN, INT_MAX, lazy);
+}
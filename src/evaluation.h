@@ -1,6 +1,8 @@
 #ifndef EVALUATION_H
 #define EVALUATION_H
 
+#include <array>
+#include <cstdint>
 #include "chess.hpp"
 #include "bbmanipulation.h"
 
@@ -26,8 +28,31 @@ const chess::PieceType PIECETYPES[6] = {
     chess::PieceType::KING
 };
 
+// A middlegame and an endgame value packed into one integer
+/* The endgame value is kept in the upper 16 bits and the middlegame value 
+    in the lower 16 bits, so adding or subtracting two Scores, or 
+    multiplying one by an integer, works on both values at once. Each value 
+    has to stay within the int16 range. */
+typedef int32_t Score;
+
+constexpr Score S(int mg, int eg) {
+    return (Score)((uint32_t)eg << 16) + mg;
+}
+
+// The lower half is signed, so a negative middlegame value borrows one 
+// from the endgame half, which the rounding of eg_value() gives back
+constexpr int mg_value(Score score) {
+    return (int16_t)(uint16_t)(uint32_t)score;
+}
+
+constexpr int eg_value(Score score) {
+    return (int16_t)(uint16_t)((uint32_t)(score + 0x8000) >> 16);
+}
+
+static_assert(mg_value(S(-5, 10) - S(20, -30)) == -25 && eg_value(S(-5, 10) - S(20, -30)) == 40);
+
 // Material Values for each piece
-const int PIECE_VALUES[6] = {
+constexpr int PIECE_VALUES[6] = {
     100, // Pawn
     320, // Knight
     330, // Bishop 
@@ -37,7 +62,7 @@ const int PIECE_VALUES[6] = {
 };
 
 // Piece Square Tables 
-const int PAWN_PST[64] = {
+constexpr int PAWN_PST[64] = {
     0,  0,  0,  0,  0,  0,  0,  0,
     50, 50, 50, 50, 50, 50, 50, 50,
     10, 10, 20, 30, 30, 20, 10, 10,
@@ -47,7 +72,7 @@ const int PAWN_PST[64] = {
     5, 10, 10,-20,-20, 10, 10,  5,
     0,  0,  0,  0,  0,  0,  0,  0
 };
-const int KNIGHT_PST[64] = {
+constexpr int KNIGHT_PST[64] = {
     -50,-40,-30,-30,-30,-30,-40,-50,
     -40,-20,  0,  0,  0,  0,-20,-40,
     -30,  0, 10, 15, 15, 10,  0,-30,
@@ -57,7 +82,7 @@ const int KNIGHT_PST[64] = {
     -40,-20,  0,  5,  5,  0,-20,-40,
     -50,-40,-30,-30,-30,-30,-40,-50
 };
-const int BISHOP_PST[64] = {
+constexpr int BISHOP_PST[64] = {
     -20,-10,-10,-10,-10,-10,-10,-20,
     -10,  0,  0,  0,  0,  0,  0,-10,
     -10,  0,  5, 10, 10,  5,  0,-10,
@@ -67,7 +92,7 @@ const int BISHOP_PST[64] = {
     -10,  5,  0,  0,  0,  0,  5,-10,
     -20,-10,-10,-10,-10,-10,-10,-20
 };
-const int ROOK_PST[64] = {
+constexpr int ROOK_PST[64] = {
     0,  0,  0,  0,  0,  0,  0,  0,
     5, 10, 10, 10, 10, 10, 10,  5,
     -5,  0,  0,  0,  0,  0,  0, -5,
@@ -77,7 +102,7 @@ const int ROOK_PST[64] = {
     -5,  0,  0,  0,  0,  0,  0, -5,
     0,  0,  0,  5,  5,  0,  0,  0
 };
-const int QUEEN_PST[64] = {
+constexpr int QUEEN_PST[64] = {
     -20,-10,-10, -5, -5,-10,-10,-20,
     -10,  0,  0,  0,  0,  0,  0,-10,
     -10,  0,  5,  5,  5,  5,  0,-10,
@@ -87,7 +112,7 @@ const int QUEEN_PST[64] = {
     -10,  0,  5,  0,  0,  0,  0,-10,
     -20,-10,-10, -5, -5,-10,-10,-20
 };
-const int KING_PST[64] = {
+constexpr int KING_PST[64] = {
     -30,-40,-40,-50,-50,-40,-40,-30,
     -30,-40,-40,-50,-50,-40,-40,-30,
     -30,-40,-40,-50,-50,-40,-40,-30,
@@ -97,7 +122,7 @@ const int KING_PST[64] = {
     20, 20,  0,  0,  0,  0, 20, 20,
     20, 30, 10,  0,  0, 10, 30, 20
 };
-const int KING_EG_PST[64] = {
+constexpr int KING_EG_PST[64] = {
     -50,-40,-30,-20,-20,-30,-40,-50,
     -30,-20,-10,  0,  0,-10,-20,-30,
     -30,-10, 20, 30, 30, 20,-10,-30,
@@ -107,7 +132,7 @@ const int KING_EG_PST[64] = {
     -30,-30,  0,  0,  0,  0,-30,-30,
     -50,-30,-30,-30,-30,-30,-30,-50
 };
-const int FLIP[64] = {
+constexpr int FLIP[64] = {
     56, 57, 58, 59, 60, 61, 62, 63,
     48, 49, 50, 51, 52, 53, 54, 55,
     40, 41, 42, 43, 44, 45, 46, 47,
@@ -119,27 +144,91 @@ const int FLIP[64] = {
 };
 
 // Piece mobility arrays
-const int knightMob[9] = {-75, -57, -9, -2, 6, 14, 22, 29, 36};
-const int bishopMob[14] = {-48, -20, 16, 26, 38, 51, 55, 63, 63, 68, 81, 81, 91, 98};
-const int rookMob[15] = {-58, -27, -15, -10, -5, -2, 9, 16, 30, 29, 32, 38, 46, 48, 58};
-const int queenMob[28] = {-39, -21, 3, 3, 14, 22, 28, 41, 43, 48, 56, 60, 60, 66, 67, 70, 71, 73, 79, 88, 88, 99, 102, 102, 106, 109, 113, 116};
+constexpr Score knightMob[9] = {S(-75, -75), S(-57, -57), S(-9, -9), S(-2, -2), S(6, 6), S(14, 14), S(22, 22), S(29, 29), S(36, 36)};
+constexpr Score bishopMob[14] = {S(-48, -48), S(-20, -20), S(16, 16), S(26, 26), S(38, 38), S(51, 51), S(55, 55), S(63, 63), S(63, 63), S(68, 68), S(81, 81), S(81, 81), S(91, 91), S(98, 98)};
+constexpr Score rookMob[15] = {S(-58, -58), S(-27, -27), S(-15, -15), S(-10, -10), S(-5, -5), S(-2, -2), S(9, 9), S(16, 16), S(30, 30), S(29, 29), S(32, 32), S(38, 38), S(46, 46), S(48, 48), S(58, 58)};
+constexpr Score queenMob[28] = {S(-39, -39), S(-21, -21), S(3, 3), S(3, 3), S(14, 14), S(22, 22), S(28, 28), S(41, 41), S(43, 43), S(48, 48), S(56, 56), S(60, 60), S(60, 60), S(66, 66), S(67, 67), S(70, 70), S(71, 71), S(73, 73), S(79, 79), S(88, 88), S(88, 88), S(99, 99), S(102, 102), S(102, 102), S(106, 106), S(109, 109), S(113, 113), S(116, 116)};
 
 // King Safety Table 
-const int safetyTable[100] = {
-    0,  0,   1,   2,   3,   5,   7,   9,  12,  15,
-    18,  22,  26,  30,  35,  39,  44,  50,  56,  62,
-    68,  75,  82,  85,  89,  97, 105, 113, 122, 131,
-    140, 150, 169, 180, 191, 202, 213, 225, 237, 248,
-    260, 272, 283, 295, 307, 319, 330, 342, 354, 366,
-    377, 389, 401, 412, 424, 436, 448, 459, 471, 483,
-    494, 500, 500, 500, 500, 500, 500, 500, 500, 500,
-    500, 500, 500, 500, 500, 500, 500, 500, 500, 500,
-    500, 500, 500, 500, 500, 500, 500, 500, 500, 500,
-    500, 500, 500, 500, 500, 500, 500, 500, 500, 500
+constexpr Score safetyTable[100] = {
+    S(0, 0), S(0, 0), S(1, 1), S(2, 2), S(3, 3),
+    S(5, 5), S(7, 7), S(9, 9), S(12, 12), S(15, 15),
+    S(18, 18), S(22, 22), S(26, 26), S(30, 30), S(35, 35),
+    S(39, 39), S(44, 44), S(50, 50), S(56, 56), S(62, 62),
+    S(68, 68), S(75, 75), S(82, 82), S(85, 85), S(89, 89),
+    S(97, 97), S(105, 105), S(113, 113), S(122, 122), S(131, 131),
+    S(140, 140), S(150, 150), S(169, 169), S(180, 180), S(191, 191),
+    S(202, 202), S(213, 213), S(225, 225), S(237, 237), S(248, 248),
+    S(260, 260), S(272, 272), S(283, 283), S(295, 295), S(307, 307),
+    S(319, 319), S(330, 330), S(342, 342), S(354, 354), S(366, 366),
+    S(377, 377), S(389, 389), S(401, 401), S(412, 412), S(424, 424),
+    S(436, 436), S(448, 448), S(459, 459), S(471, 471), S(483, 483),
+    S(494, 494), S(500, 500), S(500, 500), S(500, 500), S(500, 500),
+    S(500, 500), S(500, 500), S(500, 500), S(500, 500), S(500, 500),
+    S(500, 500), S(500, 500), S(500, 500), S(500, 500), S(500, 500),
+    S(500, 500), S(500, 500), S(500, 500), S(500, 500), S(500, 500),
+    S(500, 500), S(500, 500), S(500, 500), S(500, 500), S(500, 500),
+    S(500, 500), S(500, 500), S(500, 500), S(500, 500), S(500, 500),
+    S(500, 500), S(500, 500), S(500, 500), S(500, 500), S(500, 500),
+    S(500, 500), S(500, 500), S(500, 500), S(500, 500), S(500, 500)
 };
 
-int evaluate(chess::Board board);
+// Builds the material plus piece-square value of every piece on every 
+// square, indexed by chess::Piece and square. Queens have no middlegame 
+// piece-square value and kings use KING_EG_PST in the endgame.
+constexpr std::array<std::array<Score, 64>, 12> make_psqt() {
+    std::array<std::array<Score, 64>, 12> psqt{};
+    for (int c=0; c<2; c++) {
+        for (int p=PAWN; p<=KING; p++) {
+            for (int sq=0; sq<64; sq++) {
+                int idx = c == 0 ? FLIP[sq] : sq;
+                int mg = 0, eg = 0;
+                switch (p) {
+                    case PAWN:   mg = eg = PAWN_PST[idx]; break;
+                    case KNIGHT: mg = eg = KNIGHT_PST[idx]; break;
+                    case BISHOP: mg = eg = BISHOP_PST[idx]; break;
+                    case ROOK:   mg = eg = ROOK_PST[idx]; break;
+                    case QUEEN:  eg = QUEEN_PST[idx]; break;
+                    case KING:   mg = KING_PST[idx]; eg = KING_EG_PST[idx]; break;
+                }
+                psqt[c * 6 + p][sq] = S(PIECE_VALUES[p] + mg, PIECE_VALUES[p] + eg);
+            }
+        }
+    }
+    return psqt;
+}
+
+inline constexpr std::array<std::array<Score, 64>, 12> PSQT = make_psqt();
+
+// Attack information of a position, built once per evaluation and shared 
+// by the mobility and king safety terms
+struct EvalInfo {
+    chess::Bitboard pawnAttacks[2];     // squares attacked by the pawns of a color
+    chess::Bitboard kingZone[2];        // squares around the king of a color
+    int kingAttackWeight[2];            // weighted attacks on the king zone of a color
+};
+
+class Position;
+class PawnTable;
+struct PawnEntry;
+
+// Margin of the lazy evaluation, larger than the sum of the terms left out 
+// in almost every position of the bench
+const int LAZY_MARGIN = 200;
+
+// Pawn structure terms are looked up in the thread's pawn table
+int evaluate(const Position& board, PawnTable& pawnTable);
+
+// Evaluates within an alpha-beta window
+/* When the material, piece-square and king endgame terms are outside the 
+    window by more than LAZY_MARGIN, their sum is returned at once and lazy 
+    is set, the result is then only good enough to fail high or low. */
+int evaluate(const Position& board, PawnTable& pawnTable, int alpha, int beta, bool& lazy);
+
+// Blends the middlegame and endgame values of a score by the endgame weight
+int taper(Score score, int egWeight);
 
-int material_count(chess::Board board, chess::Color c, bool endgame);
+// Computes the pawn structure terms of a position for the pawn table
+void evaluate_pawns(const chess::Board& board, PawnEntry& entry);
 
 #endif
\ No newline at end of file
@@ -1,6 +1,40 @@
 #include "uci.h"
 
-int main() {
+int main(int argc, char *argv[]) {
+    // Command line mode: Firestorm bench [depth] [hash] [threads]
+    if (argc > 1 && std::string(argv[1]) == "bench") {
+        int depth = argc > 2 ? std::stoi(argv[2]) : BENCH_DEPTH;
+        int hashMb = argc > 3 ? std::stoi(argv[3]) : BENCH_HASH_MB;
+        int threads = argc > 4 ? std::stoi(argv[4]) : BENCH_THREADS;
+        PrepareEvaluation();
+        Bench(depth, hashMb, threads);
+        return 0;
+    }
+    // Command line mode: Firestorm evalbench [iterations]
+    if (argc > 1 && std::string(argv[1]) == "evalbench") {
+        PrepareEvaluation();
+        EvalBench(argc > 2 ? std::stoi(argv[2]) : EVAL_BENCH_ITERATIONS);
+        return 0;
+    }
+    // Command line mode: Firestorm perft <depth> [fen] or Firestorm perft suite
+    if (argc > 2 && std::string(argv[1]) == "perft") {
+        if (std::string(argv[2]) == "suite") {
+            return PerftSuite(DefaultPerftThreads()) ? 0 : 1;
+        }
+        std::string fen;
+        for (int i=3; i<argc; i++) {
+            fen += std::string(argv[i]) + " ";
+        }
+        chess::Board board(fen.empty() ? std::string(chess::constants::STARTPOS) : fen);
+        PerftDivide(board, std::stoi(argv[2]), DefaultPerftThreads(), true);
+        return 0;
+    }
+    // Command line mode: Firestorm ttstress [threads] [operations]
+    if (argc > 1 && std::string(argv[1]) == "ttstress") {
+        int threads = argc > 2 ? std::stoi(argv[2]) : TT_STRESS_THREADS;
+        uint64_t operations = argc > 3 ? std::stoull(argv[3]) : TT_STRESS_OPERATIONS;
+        return StressTranspositionTable(threads, operations) ? 0 : 1;
+    }
     UCI uci = UCI();
     uci.loop();
     return 0;
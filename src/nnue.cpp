@@ -0,0 +1,483 @@
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <vector>
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "nnue.h"
+#include "position.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define NNUE_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+// Network compiled into the binary
+/* Build with -DNNUE_EMBEDDED_FILE='"path/to/net.nnue"' to embed a network. 
+    The assembler's .incbin directive copies the file into the read-only 
+    data of the executable, where the OS shares its pages between all 
+    running engines like any other part of the binary. */
+#if defined(NNUE_EMBEDDED_FILE) && defined(__GNUC__) && !defined(_WIN32)
+#if defined(__APPLE__)
+#define NNUE_SYMBOL(name) "_" #name
+#define NNUE_RODATA ".const_data"
+#else
+#define NNUE_SYMBOL(name) #name
+#define NNUE_RODATA ".section .rodata"
+#endif
+asm(NNUE_RODATA "\n"
+    ".balign 64\n"
+    ".globl " NNUE_SYMBOL(embeddedNetworkData) "\n"
+    NNUE_SYMBOL(embeddedNetworkData) ":\n"
+    ".incbin \"" NNUE_EMBEDDED_FILE "\"\n"
+    ".globl " NNUE_SYMBOL(embeddedNetworkEnd) "\n"
+    NNUE_SYMBOL(embeddedNetworkEnd) ":\n"
+    ".byte 0\n"
+    ".text\n");
+extern "C" const char embeddedNetworkData[];
+extern "C" const char embeddedNetworkEnd[];
+#define NNUE_EMBEDDED
+#endif
+
+// Stockfish 12 network file constants
+const uint32_t NNUE_VERSION = 0x7AF32F16;
+const int NNUE_WEIGHT_SCALE_BITS = 6;   // hidden layer outputs are scaled down by 64
+const int NNUE_OUTPUT_SCALE = 16;       // the output is 16 times the eval in centipawns
+
+// The feature transformer weights make up almost all of a network, they are 
+// used where the file lies in memory. The small layers are copied.
+struct Network {
+    const int16_t* ftWeights = nullptr; // [NNUE_INPUTS][NNUE_HALF_DIMENSIONS]
+    std::vector<int16_t> ftBiases;      // [NNUE_HALF_DIMENSIONS]
+    std::vector<int32_t> biases1;       // [NNUE_HIDDEN]
+    std::vector<int8_t> weights1;       // [NNUE_HIDDEN][2 * NNUE_HALF_DIMENSIONS]
+    std::vector<int32_t> biases2;       // [NNUE_HIDDEN]
+    std::vector<int8_t> weights2;       // [NNUE_HIDDEN][NNUE_HIDDEN]
+    std::vector<int32_t> biases3;       // [1]
+    std::vector<int8_t> weights3;       // [NNUE_HIDDEN]
+
+    // Backing memory of ftWeights, at most one of them is used
+    std::vector<char> buffer;           // file read or weights copied into memory
+    const void* mapping = nullptr;      // file mapped read-only
+    size_t mappingSize = 0;
+#if defined(_WIN32)
+    HANDLE mappingHandle = nullptr;
+#endif
+};
+
+Network network;
+bool networkLoaded = false;
+bool useNNUE = false;
+
+// ****************KERNELS****************
+
+// The hot loops of the network, one implementation per instruction set
+/* The inputs of the dense layers are clipped to [0, 127], so the pairwise
+    products summed by maddubs stay below 2 * 127 * 128 and never saturate,
+    which makes every implementation return exactly the same values. */
+struct Kernels {
+    const char* name;
+    void (*addColumn)(int16_t* acc, const int16_t* column);
+    void (*subColumn)(int16_t* acc, const int16_t* column);
+    void (*clip)(const int16_t* acc, uint8_t* out);     // NNUE_HALF_DIMENSIONS values to [0, 127]
+    int32_t (*dot)(const uint8_t* input, const int8_t* weights, int size);
+};
+
+void AddColumnScalar(int16_t* acc, const int16_t* column) {
+    for (int i=0; i<NNUE_HALF_DIMENSIONS; i++) {
+        acc[i] += column[i];
+    }
+}
+
+void SubColumnScalar(int16_t* acc, const int16_t* column) {
+    for (int i=0; i<NNUE_HALF_DIMENSIONS; i++) {
+        acc[i] -= column[i];
+    }
+}
+
+void ClipScalar(const int16_t* acc, uint8_t* out) {
+    for (int i=0; i<NNUE_HALF_DIMENSIONS; i++) {
+        out[i] = (uint8_t)std::clamp<int>(acc[i], 0, 127);
+    }
+}
+
+int32_t DotScalar(const uint8_t* input, const int8_t* weights, int size) {
+    int32_t sum = 0;
+    for (int i=0; i<size; i++) {
+        sum += input[i] * weights[i];
+    }
+    return sum;
+}
+
+const Kernels SCALAR_KERNELS = {"scalar", AddColumnScalar, SubColumnScalar, ClipScalar, DotScalar};
+
+#ifdef NNUE_X86_KERNELS
+
+__attribute__((target("sse4.1"))) void AddColumnSSE41(int16_t* acc, const int16_t* column) {
+    for (int i=0; i<NNUE_HALF_DIMENSIONS; i+=8) {
+        __m128i a = _mm_load_si128((const __m128i*)(acc + i));
+        __m128i c = _mm_loadu_si128((const __m128i*)(column + i));
+        _mm_store_si128((__m128i*)(acc + i), _mm_add_epi16(a, c));
+    }
+}
+
+__attribute__((target("sse4.1"))) void SubColumnSSE41(int16_t* acc, const int16_t* column) {
+    for (int i=0; i<NNUE_HALF_DIMENSIONS; i+=8) {
+        __m128i a = _mm_load_si128((const __m128i*)(acc + i));
+        __m128i c = _mm_loadu_si128((const __m128i*)(column + i));
+        _mm_store_si128((__m128i*)(acc + i), _mm_sub_epi16(a, c));
+    }
+}
+
+__attribute__((target("sse4.1"))) void ClipSSE41(const int16_t* acc, uint8_t* out) {
+    const __m128i max = _mm_set1_epi8(127);
+    for (int i=0; i<NNUE_HALF_DIMENSIONS; i+=16) {
+        __m128i lo = _mm_load_si128((const __m128i*)(acc + i));
+        __m128i hi = _mm_load_si128((const __m128i*)(acc + i + 8));
+        __m128i packed = _mm_min_epu8(_mm_packus_epi16(lo, hi), max);
+        _mm_storeu_si128((__m128i*)(out + i), packed);
+    }
+}
+
+// size must be a multiple of 16
+__attribute__((target("sse4.1"))) int32_t DotSSE41(const uint8_t* input, const int8_t* weights, int size) {
+    const __m128i ones = _mm_set1_epi16(1);
+    __m128i sum = _mm_setzero_si128();
+    for (int i=0; i<size; i+=16) {
+        __m128i in = _mm_loadu_si128((const __m128i*)(input + i));
+        __m128i w = _mm_loadu_si128((const __m128i*)(weights + i));
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_maddubs_epi16(in, w), ones));
+    }
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4E));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xB1));
+    return _mm_cvtsi128_si32(sum);
+}
+
+const Kernels SSE41_KERNELS = {"sse4.1", AddColumnSSE41, SubColumnSSE41, ClipSSE41, DotSSE41};
+
+__attribute__((target("avx2"))) void AddColumnAVX2(int16_t* acc, const int16_t* column) {
+    for (int i=0; i<NNUE_HALF_DIMENSIONS; i+=16) {
+        __m256i a = _mm256_load_si256((const __m256i*)(acc + i));
+        __m256i c = _mm256_loadu_si256((const __m256i*)(column + i));
+        _mm256_store_si256((__m256i*)(acc + i), _mm256_add_epi16(a, c));
+    }
+}
+
+__attribute__((target("avx2"))) void SubColumnAVX2(int16_t* acc, const int16_t* column) {
+    for (int i=0; i<NNUE_HALF_DIMENSIONS; i+=16) {
+        __m256i a = _mm256_load_si256((const __m256i*)(acc + i));
+        __m256i c = _mm256_loadu_si256((const __m256i*)(column + i));
+        _mm256_store_si256((__m256i*)(acc + i), _mm256_sub_epi16(a, c));
+    }
+}
+
+__attribute__((target("avx2"))) void ClipAVX2(const int16_t* acc, uint8_t* out) {
+    const __m256i max = _mm256_set1_epi8(127);
+    for (int i=0; i<NNUE_HALF_DIMENSIONS; i+=32) {
+        __m256i lo = _mm256_load_si256((const __m256i*)(acc + i));
+        __m256i hi = _mm256_load_si256((const __m256i*)(acc + i + 16));
+        // packus works within 128-bit lanes, the permute puts the values back in order
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xD8);
+        _mm256_storeu_si256((__m256i*)(out + i), _mm256_min_epu8(packed, max));
+    }
+}
+
+// size must be a multiple of 32
+__attribute__((target("avx2"))) int32_t DotAVX2(const uint8_t* input, const int8_t* weights, int size) {
+    const __m256i ones = _mm256_set1_epi16(1);
+    __m256i sum = _mm256_setzero_si256();
+    for (int i=0; i<size; i+=32) {
+        __m256i in = _mm256_loadu_si256((const __m256i*)(input + i));
+        __m256i w = _mm256_loadu_si256((const __m256i*)(weights + i));
+        sum = _mm256_add_epi32(sum, _mm256_madd_epi16(_mm256_maddubs_epi16(in, w), ones));
+    }
+    __m128i sum128 = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    sum128 = _mm_add_epi32(sum128, _mm_shuffle_epi32(sum128, 0x4E));
+    sum128 = _mm_add_epi32(sum128, _mm_shuffle_epi32(sum128, 0xB1));
+    return _mm_cvtsi128_si32(sum128);
+}
+
+const Kernels AVX2_KERNELS = {"avx2", AddColumnAVX2, SubColumnAVX2, ClipAVX2, DotAVX2};
+
+#endif
+
+// Picks the fastest kernels the CPU supports
+const Kernels* SelectKernels() {
+#ifdef NNUE_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return &AVX2_KERNELS;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        return &SSE41_KERNELS;
+    }
+#endif
+    return &SCALAR_KERNELS;
+}
+
+const Kernels* kernels = SelectKernels();
+
+const char* NNUEKernelName() {
+    return kernels->name;
+}
+
+// ****************NETWORK****************
+
+// Maps a file read-only into net.mapping, returns false if it cannot be mapped
+/* The mapping is shared, so every engine process that maps the same 
+    network uses the same physical pages, and only the pages that are 
+    touched are read from disk. */
+bool MapFile(const std::string& path, Network& net) {
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER fileSize;
+    HANDLE mapping = GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0 
+        ? CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+    CloseHandle(file);
+    if (!mapping) {
+        return false;
+    }
+    const void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!data) {
+        CloseHandle(mapping);
+        return false;
+    }
+    net.mappingHandle = mapping;
+    net.mapping = data;
+    net.mappingSize = size_t(fileSize.QuadPart);
+    return true;
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1) {
+        return false;
+    }
+    struct stat st;
+    void* data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd); // the mapping stays valid
+    if (data == MAP_FAILED) {
+        return false;
+    }
+    net.mapping = data;
+    net.mappingSize = size_t(st.st_size);
+    return true;
+#endif
+}
+
+void UnmapFile(Network& net) {
+    if (!net.mapping) {
+        return;
+    }
+#if defined(_WIN32)
+    UnmapViewOfFile(net.mapping);
+    CloseHandle(net.mappingHandle);
+#else
+    munmap(const_cast<void*>(net.mapping), net.mappingSize);
+#endif
+    net.mapping = nullptr;
+}
+
+// Reads values in the file's little-endian layout, which is used as it is
+template <typename T>
+bool ReadValues(const char* data, size_t size, size_t& offset, std::vector<T>& values, size_t count) {
+    if (size - offset < count * sizeof(T)) {
+        return false;
+    }
+    values.resize(count);
+    std::memcpy(values.data(), data + offset, count * sizeof(T));
+    offset += count * sizeof(T);
+    return true;
+}
+
+bool ReadU32(const char* data, size_t size, size_t& offset, uint32_t& value) {
+    if (size - offset < sizeof(value)) {
+        return false;
+    }
+    std::memcpy(&value, data + offset, sizeof(value));
+    offset += sizeof(value);
+    return true;
+}
+
+// Parses a network that stays at data, returns false if it is not valid
+bool ParseNetwork(const char* data, size_t size, Network& net) {
+    size_t offset = 0;
+    uint32_t version, hash, descriptionSize;
+    if (!ReadU32(data, size, offset, version) || version != NNUE_VERSION
+        || !ReadU32(data, size, offset, hash) 
+        || !ReadU32(data, size, offset, descriptionSize) || size - offset < descriptionSize) {
+        return false;
+    }
+    offset += descriptionSize;
+    size_t ftWeightsBytes = sizeof(int16_t) * NNUE_HALF_DIMENSIONS * size_t(NNUE_INPUTS);
+    if (!ReadU32(data, size, offset, hash) 
+        || !ReadValues(data, size, offset, net.ftBiases, NNUE_HALF_DIMENSIONS)
+        || size - offset < ftWeightsBytes) {
+        return false;
+    }
+    const char* ftWeights = data + offset;
+    offset += ftWeightsBytes;
+    bool ok = ReadU32(data, size, offset, hash)
+        && ReadValues(data, size, offset, net.biases1, NNUE_HIDDEN)
+        && ReadValues(data, size, offset, net.weights1, NNUE_HIDDEN * 2 * NNUE_HALF_DIMENSIONS)
+        && ReadValues(data, size, offset, net.biases2, NNUE_HIDDEN)
+        && ReadValues(data, size, offset, net.weights2, NNUE_HIDDEN * NNUE_HIDDEN)
+        && ReadValues(data, size, offset, net.biases3, 1)
+        && ReadValues(data, size, offset, net.weights3, NNUE_HIDDEN);
+    // A valid network ends right after the output layer
+    if (!ok || offset != size) {
+        return false;
+    }
+    // The description can leave the weights at an odd address, which the 
+    // kernels cannot read from, so they are copied then
+    if (reinterpret_cast<uintptr_t>(ftWeights) % alignof(int16_t) != 0) {
+        std::vector<char> copy(ftWeights, ftWeights + ftWeightsBytes);
+        net.buffer.swap(copy);
+        ftWeights = net.buffer.data();
+    }
+    net.ftWeights = reinterpret_cast<const int16_t*>(ftWeights);
+    return true;
+}
+
+// Replaces the current network, which is only done while no search runs
+void SetNetwork(Network& net) {
+    UnmapFile(network);
+    network = std::move(net);
+    networkLoaded = true;
+}
+
+bool LoadNetwork(const std::string& path) {
+    Network net;
+    if (MapFile(path, net)) {
+        if (ParseNetwork(static_cast<const char*>(net.mapping), net.mappingSize, net)) {
+            SetNetwork(net);
+            return true;
+        }
+        UnmapFile(net);
+        return false;
+    }
+    // Files that cannot be mapped are read into memory
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+    std::vector<char> contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (!ParseNetwork(contents.data(), contents.size(), net)) {
+        return false;
+    }
+    if (net.buffer.empty()) {
+        net.buffer = std::move(contents); // ftWeights points into contents, moving keeps it valid
+    }
+    SetNetwork(net);
+    return true;
+}
+
+bool HasEmbeddedNetwork() {
+#ifdef NNUE_EMBEDDED
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool LoadEmbeddedNetwork() {
+#ifdef NNUE_EMBEDDED
+    Network net;
+    if (ParseNetwork(embeddedNetworkData, size_t(embeddedNetworkEnd - embeddedNetworkData), net)) {
+        SetNetwork(net);
+        return true;
+    }
+#endif
+    return false;
+}
+
+bool NetworkLoaded() {
+    return networkLoaded;
+}
+
+void SetUseNNUE(bool use) {
+    useNNUE = use && networkLoaded;
+}
+
+bool UsingNNUE() {
+    return useNNUE;
+}
+
+// ****************FEATURES****************
+
+/* The black side sees the board rotated by 180 degrees. Within a king
+    square, index 0 is unused and the pieces follow in the order friendly
+    pawn, enemy pawn, friendly knight, ..., enemy queen, 64 squares each. */
+int FeatureIndex(chess::Color perspective, chess::Square kingSq, chess::Piece piece, chess::Square sq) {
+    int orient = perspective == chess::Color::WHITE ? 0 : 63;
+    int pieceIndex = (int(piece.type()) * 2 + (piece.color() != perspective)) * 64 + 1;
+    return (sq.index() ^ orient) + pieceIndex + NNUE_PIECE_SQUARES * (kingSq.index() ^ orient);
+}
+
+void AddFeature(Accumulator& acc, chess::Color perspective, int index) {
+    kernels->addColumn(acc.values[perspective], &network.ftWeights[size_t(index) * NNUE_HALF_DIMENSIONS]);
+}
+
+void SubFeature(Accumulator& acc, chess::Color perspective, int index) {
+    kernels->subColumn(acc.values[perspective], &network.ftWeights[size_t(index) * NNUE_HALF_DIMENSIONS]);
+}
+
+void RefreshAccumulator(const chess::Board& board, chess::Color perspective, Accumulator& acc) {
+    std::copy(network.ftBiases.begin(), network.ftBiases.end(), acc.values[perspective]);
+    chess::Square kingSq = board.kingSq(perspective);
+    chess::Bitboard pieces = board.occ() & ~board.pieces(chess::PieceType::KING);
+    while (pieces) {
+        chess::Square sq = pieces.pop();
+        AddFeature(acc, perspective, FeatureIndex(perspective, kingSq, board.at(sq), sq));
+    }
+}
+
+// ****************EVALUATION****************
+
+// Runs a dense layer followed by the clipped ReLU of its outputs
+void DenseLayer(const Kernels& k, const uint8_t* input, int inputs, const int8_t* weights, const int32_t* biases, uint8_t* output) {
+    for (int i=0; i<NNUE_HIDDEN; i++) {
+        int32_t sum = biases[i] + k.dot(input, weights + i * inputs, inputs);
+        output[i] = (uint8_t)std::clamp(sum >> NNUE_WEIGHT_SCALE_BITS, 0, 127);
+    }
+}
+
+// Runs the layers after the feature transformer and returns the raw output
+int32_t Propagate(const Kernels& k, const Accumulator& acc, chess::Color stm) {
+    alignas(32) uint8_t input[2 * NNUE_HALF_DIMENSIONS];
+    alignas(32) uint8_t hidden1[NNUE_HIDDEN];
+    alignas(32) uint8_t hidden2[NNUE_HIDDEN];
+    k.clip(acc.values[stm], input);
+    k.clip(acc.values[~stm], input + NNUE_HALF_DIMENSIONS);
+    DenseLayer(k, input, 2 * NNUE_HALF_DIMENSIONS, network.weights1.data(), network.biases1.data(), hidden1);
+    DenseLayer(k, hidden1, NNUE_HIDDEN, network.weights2.data(), network.biases2.data(), hidden2);
+    return network.biases3[0] + k.dot(hidden2, network.weights3.data(), NNUE_HIDDEN);
+}
+
+int EvaluateNNUE(const Position& board) {
+    const Accumulator& acc = board.accumulator();
+    int32_t output = Propagate(*kernels, acc, board.sideToMove());
+#ifdef DEBUG_EVAL
+    // The incrementally updated accumulator must match a full refresh
+    Accumulator fresh;
+    for (chess::Color c : {chess::Color::WHITE, chess::Color::BLACK}) {
+        RefreshAccumulator(board, c, fresh);
+        assert(std::equal(fresh.values[c], fresh.values[c] + NNUE_HALF_DIMENSIONS, acc.values[c]));
+    }
+    // The SIMD kernels must give the same result as the scalar ones
+    assert(output == Propagate(SCALAR_KERNELS, acc, board.sideToMove()));
+#endif
+    return output / NNUE_OUTPUT_SCALE;
+}
@@ -0,0 +1,69 @@
+#ifndef NNUE_H
+#define NNUE_H
+
+#include <cstdint>
+#include <string>
+#include "chess.hpp"
+
+// Efficiently updatable neural network evaluation
+/* The network uses HalfKP features: for each side, every piece other than
+    the kings is one input, indexed by the square of that side's king, the
+    piece and its square, all seen from that side. The feature transformer
+    turns the active inputs into 256 int16 values per side, the
+    accumulator. As a move only changes a few inputs, the accumulator is
+    updated by adding and subtracting the weights of those inputs, except
+    when a king moves, which changes all inputs of its side. Two int8 hidden
+    layers of 32 neurons and an output neuron turn both accumulators, the
+    side to move first, into the evaluation.
+
+    Networks are read in the Stockfish 12 HalfKP 256x2-32-32 format, so
+    the networks trained for it can be used as they are. */
+
+const int NNUE_HALF_DIMENSIONS = 256;
+const int NNUE_PIECE_SQUARES = 10 * 64 + 1;                 // piece-square inputs per king square
+const int NNUE_INPUTS = 64 * NNUE_PIECE_SQUARES;
+const int NNUE_HIDDEN = 32;
+
+// Default of the EvalFile option, the embedded network is used when no 
+// file of this name is found
+const std::string NNUE_DEFAULT_FILE = "nn.nnue";
+
+// Feature transformer output of a position for both sides
+struct alignas(32) Accumulator {
+    int16_t values[2][NNUE_HALF_DIMENSIONS];
+};
+
+class Position;
+
+// Maps a network file, returns false and keeps the current network if it 
+// cannot be read or is not valid
+bool LoadNetwork(const std::string& path);
+
+// Uses the network compiled into the binary, if there is one
+bool HasEmbeddedNetwork();
+bool LoadEmbeddedNetwork();
+
+bool NetworkLoaded();
+
+// The NNUE evaluation can only be used once a network is loaded
+void SetUseNNUE(bool use);
+bool UsingNNUE();
+
+// Returns the input index of a piece on a square, seen from a side whose
+// king is on kingSq
+int FeatureIndex(chess::Color perspective, chess::Square kingSq, chess::Piece piece, chess::Square sq);
+
+// Adds or subtracts the weights of an input from one side of an accumulator
+void AddFeature(Accumulator& acc, chess::Color perspective, int index);
+void SubFeature(Accumulator& acc, chess::Color perspective, int index);
+
+// Recomputes one side of an accumulator from scratch
+void RefreshAccumulator(const chess::Board& board, chess::Color perspective, Accumulator& acc);
+
+// Returns the network's evaluation, relative to the side to move
+int EvaluateNNUE(const Position& board);
+
+// Name of the SIMD kernels picked for this CPU
+const char* NNUEKernelName();
+
+#endif
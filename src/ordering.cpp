@@ -1,48 +1,258 @@
 #include "ordering.h"
+#include "evaluation.h"
 
-const int PIECE_VALUES[6] = {
-    100,  // Pawn
-    320,  // Knight
-    330,  // Bishop
-    500,  // Rook
-    900,  // Queen
-    20000 // King
-};
+// Returns the pieces of both colors that attack a square
+chess::Bitboard AttackersTo(const chess::Board& board, chess::Square sq, chess::Bitboard occupied) {
+    chess::Bitboard bishopsQueens = board.pieces(chess::PieceType::BISHOP) | board.pieces(chess::PieceType::QUEEN);
+    chess::Bitboard rooksQueens = board.pieces(chess::PieceType::ROOK) | board.pieces(chess::PieceType::QUEEN);
+    return (chess::attacks::pawn(chess::Color::WHITE, sq) & board.pieces(chess::PieceType::PAWN, chess::Color::BLACK))
+        | (chess::attacks::pawn(chess::Color::BLACK, sq) & board.pieces(chess::PieceType::PAWN, chess::Color::WHITE))
+        | (chess::attacks::knight(sq) & board.pieces(chess::PieceType::KNIGHT))
+        | (chess::attacks::bishop(sq, occupied) & bishopsQueens)
+        | (chess::attacks::rook(sq, occupied) & rooksQueens)
+        | (chess::attacks::king(sq) & board.pieces(chess::PieceType::KING));
+}
 
-struct compare {
-    bool operator()(chess::Move const &a, chess::Move const &b) { 
-            return a.score() > b.score();
+bool SEE(const chess::Board& board, chess::Move move, int threshold) {
+    if (move.typeOf() != chess::Move::NORMAL) {
+        return 0 >= threshold;
     }
-};
+    chess::Square from = move.from(), to = move.to();
 
-void OrderMoves(chess::Board board, chess::Movelist& moves, int depth) {
-    int moveScoreGuess;
-    chess::PieceType movePieceType;
-    chess::PieceType capturePieceType;
+    // swap is what the side to move of the exchange is up if it stops now, 
+    // beyond the threshold
+    int swap = (board.at(to) == chess::Piece::NONE ? 0 : PIECE_VALUES[(int)board.at<chess::PieceType>(to)]) - threshold;
+    if (swap < 0) {
+        return false;
+    }
+    swap = PIECE_VALUES[(int)board.at<chess::PieceType>(from)] - swap;
+    if (swap <= 0) {
+        return true;
+    }
+
+    chess::Bitboard bishopsQueens = board.pieces(chess::PieceType::BISHOP) | board.pieces(chess::PieceType::QUEEN);
+    chess::Bitboard rooksQueens = board.pieces(chess::PieceType::ROOK) | board.pieces(chess::PieceType::QUEEN);
+    chess::Bitboard occupied = board.occ() ^ chess::Bitboard::fromSquare(from) ^ chess::Bitboard::fromSquare(to);
+    chess::Bitboard attackers = AttackersTo(board, to, occupied);
+    chess::Color stm = board.at(from).color();
+    int result = 1;
+
+    while (true) {
+        stm = ~stm;
+        attackers &= occupied;
+        chess::Bitboard stmAttackers = attackers & board.us(stm);
+        if (!stmAttackers) {
+            break;
+        }
+        result ^= 1;
+
+        // Recapture with the least valuable attacker, then add the sliders 
+        // it uncovers
+        int type = PAWN;
+        chess::Bitboard bb;
+        while (!(bb = stmAttackers & board.pieces(PIECETYPES[type]))) {
+            type++;
+        }
+        if (type == KING) {
+            // The king can only recapture if the other side has no attackers left
+            return (attackers & board.us(~stm)) ? result ^ 1 : result;
+        }
+        swap = PIECE_VALUES[type] - swap;
+        if (swap < result) {
+            break;
+        }
+        occupied ^= chess::Bitboard::fromSquare(bb.lsb());
+        if (type == PAWN || type == BISHOP || type == QUEEN) {
+            attackers |= chess::attacks::bishop(to, occupied) & bishopsQueens;
+        }
+        if (type == ROOK || type == QUEEN) {
+            attackers |= chess::attacks::rook(to, occupied) & rooksQueens;
+        }
+    }
+    return result;
+}
+
+void UpdateHistory(int16_t& entry, int bonus) {
+    entry += bonus - entry * std::abs(bonus) / MAX_HISTORY;
+}
+
+// A move read from the TT can belong to another position after a hash 
+// collision, and a killer comes from a sibling position, so they are only 
+// used if the piece on their from square can make them. Only that piece 
+// type's moves are generated to check this.
+bool IsLegalMove(const chess::Board& board, chess::Move move) {
+    if (move == chess::Move::NO_MOVE || move == chess::Move::NULL_MOVE) {
+        return false;
+    }
+    chess::Piece piece = board.at(move.from());
+    if (piece == chess::Piece::NONE || piece.color() != board.sideToMove()) {
+        return false;
+    }
+    chess::Movelist moves;
+    chess::movegen::legalmoves(moves, board, 1 << (int)piece.type());
+    return std::find(moves.begin(), moves.end(), move) != moves.end();
+}
+
+MovePicker::MovePicker(const chess::Board& board) 
+    : board(board), ttMove(chess::Move::NO_MOVE), history(nullptr), capturesOnly(true), stage(GEN_CAPTURES), index(0) {
+    for (int i=0; i<3; i++) {
+        refutations[i] = chess::Move::NO_MOVE;
+    }
+    contHist[0] = contHist[1] = nullptr;
+}
 
-    for (chess::Move move : moves) {
-        moveScoreGuess = 0;
-        movePieceType = board.at<chess::PieceType>(move.from());
-        capturePieceType = board.at<chess::PieceType>(move.to());
-        chess::Color oppColor = ~board.sideToMove();
+MovePicker::MovePicker(const chess::Board& board, chess::Move ttMove, const chess::Move* killers, chess::Move counterMove, 
+    const ButterflyHistory* history, const PieceToHistory* const* contHist) 
+    : board(board), ttMove(chess::Move::NO_MOVE), history(history), capturesOnly(false), stage(TT_MOVE), index(0) {
+    if (IsLegalMove(board, ttMove)) {
+        this->ttMove = ttMove;
+    }
+    refutations[0] = killers ? killers[0] : chess::Move(chess::Move::NO_MOVE);
+    refutations[1] = killers ? killers[1] : chess::Move(chess::Move::NO_MOVE);
+    // The countermove is often one of the killers
+    refutations[2] = (counterMove != refutations[0] && counterMove != refutations[1] ? counterMove : chess::Move(chess::Move::NO_MOVE));
+    for (int i=0; i<2; i++) {
+        this->contHist[i] = contHist ? contHist[i] : nullptr;
+    }
+}
 
-        // Order moves based on lines previously searched at lower depths 
-        if (TryGetStoredMove(board) == move) {
-            moveScoreGuess += 1000;
+int MovePicker::quietScore(const chess::Board& board, chess::Move move, const ButterflyHistory* history, 
+    const PieceToHistory* const* contHist) {
+    int from = move.from().index(), to = move.to().index();
+    int piece = board.at(move.from());
+    int score = 0;
+    if (history) {
+        score += (*history)[board.sideToMove()][from][to];
+    }
+    for (int i=0; i<2; i++) {
+        if (contHist && contHist[i]) {
+            score += (*contHist[i])[piece][to];
         }
+    }
+    // Each table is bounded by MAX_HISTORY, the sum must fit a move's score
+    return score / 3;
+}
 
-        // Order moves based on the MVV-LVA Heuristic (Most Valuable Victim - Least Valuable Aggressor)
-        // We prioritize capturing high value pieces using low value pieces
-        if (board.isCapture(move)) {
-            moveScoreGuess += PIECE_VALUES[(int)capturePieceType] - PIECE_VALUES[(int)movePieceType];
+// Scores captures by MVV-LVA, capturing promotions also gain the value of 
+// the new piece
+void MovePicker::scoreCaptures() {
+    for (chess::Move& move : moves) {
+        int attacker = (int)board.at<chess::PieceType>(move.from());
+        // The victim of an en passant capture is not on the to square
+        int victim = move.typeOf() == chess::Move::ENPASSANT ? (int)chess::PieceType::PAWN : (int)board.at<chess::PieceType>(move.to());
+        int score = PIECE_VALUES[victim] - PIECE_VALUES[attacker];
+        if (move.typeOf() == chess::Move::PROMOTION) {
+            score += PIECE_VALUES[(int)move.promotionType()];
         }
+        move.setScore(score);
+    }
+}
+
+// Scores quiet moves by history, promotions are put above all of them
+void MovePicker::scoreQuiets() {
+    for (chess::Move& move : moves) {
+        if (move.typeOf() == chess::Move::PROMOTION) {
+            move.setScore(MAX_HISTORY + PIECE_VALUES[(int)move.promotionType()]);
+        } else {
+            move.setScore(quietScore(board, move, history, contHist));
+        }
+    }
+}
 
-        // Priotize promotions 
-        if (move.typeOf()==chess::Move::PROMOTION) {
-            moveScoreGuess += PIECE_VALUES[(int)move.promotionType()];
+// Moves the best scored move left to index and returns it, ties go to 
+// the move generated first
+chess::Move MovePicker::pickBest() {
+    int best = index;
+    for (int i=index+1; i<moves.size(); i++) {
+        if (moves[i].score() > moves[best].score()) {
+            best = i;
         }
+    }
+    std::swap(moves[index], moves[best]);
+    return moves[index++];
+}
+
+chess::Move MovePicker::next() {
+    switch (stage) {
+        case TT_MOVE:
+            stage = GEN_CAPTURES;
+            if (ttMove != chess::Move::NO_MOVE) {
+                return ttMove;
+            }
+            [[fallthrough]];
+
+        case GEN_CAPTURES:
+            chess::movegen::legalmoves<chess::movegen::MoveGenType::CAPTURE>(moves, board);
+            scoreCaptures();
+            index = 0;
+            stage = GOOD_CAPTURES;
+            [[fallthrough]];
+
+        case GOOD_CAPTURES:
+            while (index < moves.size()) {
+                chess::Move move = pickBest();
+                if (move == ttMove) {
+                    continue;
+                }
+                if (!SEE(board, move, 0)) {
+                    // The quiescence search does not search them at all
+                    if (!capturesOnly) {
+                        badCaptures.add(move);
+                    }
+                    continue;
+                }
+                return move;
+            }
+            if (capturesOnly) {
+                index = 0;
+                stage = BAD_CAPTURES;
+                return next();
+            }
+            index = 0;
+            stage = REFUTATIONS;
+            [[fallthrough]];
+
+        case REFUTATIONS:
+            // Refutations that are captures here were already returned
+            while (index < 3) {
+                chess::Move& refutation = refutations[index++];
+                if (refutation != ttMove && !board.isCapture(refutation) && IsLegalMove(board, refutation)) {
+                    return refutation;
+                }
+                // Not returned, so it must not be skipped among the quiet moves
+                refutation = chess::Move::NO_MOVE;
+            }
+            stage = GEN_QUIETS;
+            [[fallthrough]];
+
+        case GEN_QUIETS:
+            chess::movegen::legalmoves<chess::movegen::MoveGenType::QUIET>(moves, board);
+            scoreQuiets();
+            index = 0;
+            stage = QUIETS;
+            [[fallthrough]];
+
+        case QUIETS:
+            while (index < moves.size()) {
+                chess::Move move = pickBest();
+                if (move != ttMove && move != refutations[0] && move != refutations[1] && move != refutations[2]) {
+                    return move;
+                }
+            }
+            index = 0;
+            stage = BAD_CAPTURES;
+            [[fallthrough]];
+
+        case BAD_CAPTURES:
+            // Already in order, they were put aside best first
+            if (index < badCaptures.size()) {
+                return badCaptures[index++];
+            }
+            stage = DONE;
+            [[fallthrough]];
 
-        move.setScore(move.score());
+        case DONE:
+            return chess::Move::NO_MOVE;
     }
-    std::sort(moves.begin(), moves.end(), compare());
-}
\ No newline at end of file
+    return chess::Move::NO_MOVE;
+}
@@ -1,9 +1,100 @@
 #ifndef ORDERING_H
 #define ORDERING_H
 
+#include <cstdint>
 #include "chess.hpp"
 #include "transposition.h"
 
-void OrderMoves(chess::Board board, chess::Movelist& moves, int depth); 
+// Deepest ply the search goes to
+const int MAX_PLY = 128;
 
-#endif
\ No newline at end of file
+// Bound of the history values
+const int MAX_HISTORY = 16384;
+
+// Success of quiet moves in earlier beta cutoffs, by color, from and to square
+typedef int16_t ButterflyHistory[2][64][64];
+
+// Success of quiet moves by piece and to square, following one given move
+typedef int16_t PieceToHistory[12][64];
+
+// Continuation history, a PieceToHistory for every piece and to square of 
+// the move played one or two plies before
+typedef PieceToHistory ContinuationHistory[12][64];
+
+// Quiet move that refuted each move, by the piece and to square of that move
+typedef chess::Move CounterMoves[12][64];
+
+// Adds a bonus or a penalty to a history value
+/* The change shrinks as the value nears MAX_HISTORY (gravity), so the 
+    values stay bounded and recent results weigh more than old ones. */
+void UpdateHistory(int16_t& entry, int bonus);
+
+// Static Exchange Evaluation
+/* Checks whether the exchange of captures that a move starts on its to 
+    square wins at least threshold, when both sides recapture with their 
+    least valuable piece and either side can stop. Sliders that get 
+    uncovered behind the pieces taking part (x-rays) join in, pins are 
+    ignored. Castling, en passant and promotions count as even. */
+bool SEE(const chess::Board& board, chess::Move move, int threshold);
+
+// Returns the legal moves of a position one at a time, best guesses first
+/* Moves are generated in stages, each one only when the previous stage 
+    is used up, as most nodes cut off on their first or second move: 
+    - The TT move, checked for legality without generating the other moves
+    - Good captures, by the MVV-LVA heuristic (Most Valuable Victim - Least 
+      Valuable Aggressor)
+    - The refutations: the two killer moves of the ply, quiet moves that 
+      caused a beta cutoff in a sibling node, and the countermove of the 
+      previous move
+    - Quiet moves, promotions first, then by the sum of the butterfly 
+      history and the continuation histories of the last two moves
+    - Bad captures, which lose material by SEE
+    Within a stage the best scored move left is picked by a selection step 
+    instead of sorting the whole list. */
+class MovePicker {
+    public:
+        // For the quiescence search, which only searches the captures that 
+        // do not lose material by SEE
+        MovePicker(const chess::Board& board);
+
+        // killers, history and the two continuation histories can be null 
+        // when there are none
+        MovePicker(const chess::Board& board, chess::Move ttMove, const chess::Move* killers, chess::Move counterMove, 
+            const ButterflyHistory* history, const PieceToHistory* const* contHist);
+
+        // Score of a quiet move by the histories, which stays within MAX_HISTORY
+        static int quietScore(const chess::Board& board, chess::Move move, const ButterflyHistory* history, 
+            const PieceToHistory* const* contHist);
+
+        // Returns the next move, or chess::Move::NO_MOVE once all were returned
+        chess::Move next();
+
+    private:
+        enum Stage {
+            TT_MOVE,
+            GEN_CAPTURES,
+            GOOD_CAPTURES,
+            REFUTATIONS,
+            GEN_QUIETS,
+            QUIETS,
+            BAD_CAPTURES,
+            DONE
+        };
+
+        void scoreCaptures();
+        void scoreQuiets();
+        chess::Move pickBest();
+
+        const chess::Board& board;
+        chess::Move ttMove;
+        chess::Move refutations[3];
+        const ButterflyHistory* history;
+        const PieceToHistory* contHist[2];
+        bool capturesOnly;
+        Stage stage;
+        chess::Movelist moves;
+        chess::Movelist badCaptures;
+        int index;
+};
+
+#endif
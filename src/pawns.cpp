@@ -0,0 +1,20 @@
+#include "pawns.h"
+#include "evaluation.h"
+#include "position.h"
+
+// Every entry starts with key 0, which is the key of a position without 
+// pawns, and all zero terms, which are its correct pawn structure terms
+PawnTable::PawnTable() : probes(0), hits(0), entries(PAWN_TABLE_SIZE, PawnEntry{}) {}
+
+const PawnEntry& PawnTable::probe(const Position& board) {
+    uint64_t key = board.pawnKey();
+    PawnEntry& entry = entries[key & (PAWN_TABLE_SIZE - 1)];
+    probes++;
+    if (entry.key == key) {
+        hits++;
+        return entry;
+    }
+    entry.key = key;
+    evaluate_pawns(board, entry);
+    return entry;
+}
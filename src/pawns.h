@@ -0,0 +1,39 @@
+#ifndef PAWNS_H
+#define PAWNS_H
+
+#include <cstdint>
+#include <vector>
+#include "chess.hpp"
+#include "evaluation.h"
+
+class Position;
+
+// Pawn structure terms of a position, which only depend on where the pawns are
+struct PawnEntry {
+    uint64_t key;                   // pawn key of the position
+    Score score;                    // isolani, doubled, weak and passed pawn terms, from white's side
+    chess::Bitboard passed[2];      // passed pawns of each color
+    chess::Bitboard attacks[2];     // squares attacked by the pawns of each color
+};
+
+// Entries per table, must be a power of two
+const int PAWN_TABLE_SIZE = 16384;
+
+// Caches pawn structure evaluations by pawn key
+/* The pawns rarely move inside a search tree, so most positions the search 
+    evaluates share their pawn structure with one evaluated before. */
+class PawnTable {
+    public:
+        PawnTable();
+
+        // Returns the pawn structure terms of a position, evaluating them on a miss
+        const PawnEntry& probe(const Position& board);
+
+        uint64_t probes;
+        uint64_t hits;
+
+    private:
+        std::vector<PawnEntry> entries;
+};
+
+#endif
@@ -0,0 +1,129 @@
+#include "perft.h"
+
+struct PerftPosition {
+    std::string fen;
+    int depth;
+    uint64_t nodes;
+};
+
+// Standard perft positions with known leaf counts
+// Taken from the Chess Programming Wiki and Martin Sedlak's edge case suite
+const PerftPosition PERFT_SUITE[] = {
+    {"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", 5, 4865609},
+    {"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1", 4, 4085603},
+    {"8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1", 6, 11030083},
+    {"r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1", 4, 422333},
+    {"r2q1rk1/pP1p2pp/Q4n2/bbp1p3/Np6/1B3NBn/pPPP1PPP/R3K2R b KQ - 0 1", 4, 422333},
+    {"rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8", 4, 2103487},
+    {"r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10", 4, 3894594},
+    {"3k4/3p4/8/K1P4r/8/8/8/8 b - - 0 1", 6, 1134888},         // avoid illegal en passant
+    {"8/8/4k3/8/2p5/8/B2P2K1/8 w - - 0 1", 6, 1015133},         // avoid illegal en passant
+    {"8/8/1k6/2b5/2pP4/8/5K2/8 b - d3 0 1", 6, 1440467},        // en passant capture checks opponent
+    {"5k2/8/8/8/8/8/8/4K2R w K - 0 1", 6, 661072},              // short castling gives check
+    {"3k4/8/8/8/8/8/8/R3K3 w Q - 0 1", 6, 803711},              // long castling gives check
+    {"r3k2r/1b4bq/8/8/8/8/7B/R3K2R w KQkq - 0 1", 4, 1274206},  // castling rights
+    {"r3k2r/8/3Q4/8/8/5q2/8/R3K2R b KQkq - 0 1", 4, 1720476},   // castling prevented
+    {"2K2r2/4P3/8/8/8/8/8/3k4 w - - 0 1", 6, 3821001},          // promote out of check
+    {"8/8/1P2K3/8/2n5/1q6/8/5k2 b - - 0 1", 5, 1004658},        // discovered check
+    {"4k3/1P6/8/8/8/8/K7/8 w - - 0 1", 6, 217342},              // promote to give check
+    {"8/P1k5/K7/8/8/8/8/8 w - - 0 1", 6, 92683},                // underpromote to give check
+    {"K1k5/8/P7/8/8/8/8/8 w - - 0 1", 6, 2217},                 // self stalemate
+    {"8/k1P5/8/1K6/8/8/8/8 w - - 0 1", 7, 567584},              // stalemate and checkmate
+    {"8/8/2k5/5q2/5n2/8/5K2/8 b - - 0 1", 4, 23527}             // stalemate and checkmate
+};
+
+unsigned int DefaultPerftThreads() {
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+uint64_t Perft(chess::Board& board, int depth) {
+    if (depth <= 0) {
+        return 1; // the position itself is the only leaf
+    }
+    chess::Movelist moves;
+    chess::movegen::legalmoves(moves, board);
+    // Bulk counting: the number of legal moves is the number of leaves
+    if (depth <= 1) {
+        return moves.size();
+    }
+    uint64_t nodes = 0;
+    for (const chess::Move& move : moves) {
+        board.makeMove(move);
+        nodes += Perft(board, depth - 1);
+        board.unmakeMove(move);
+    }
+    return nodes;
+}
+
+uint64_t PerftDivide(const chess::Board& board, int depth, unsigned int threads, bool verbose) {
+    // There are no root moves to split on, the root is the only leaf
+    if (depth <= 0) {
+        if (verbose) {
+            std::cout << "\nNodes searched: 1" << std::endl;
+        }
+        return 1;
+    }
+
+    chess::Movelist moves;
+    chess::movegen::legalmoves(moves, board);
+    std::vector<uint64_t> counts(moves.size(), 0);
+
+    // Every thread works on its own copy of the board and takes 
+    // the next root move that has not been searched yet
+    std::atomic<int> next(0);
+    auto worker = [&]() {
+        chess::Board threadBoard = board;
+        for (int i = next++; i < moves.size(); i = next++) {
+            if (depth <= 1) {
+                counts[i] = 1;
+                continue;
+            }
+            threadBoard.makeMove(moves[i]);
+            counts[i] = Perft(threadBoard, depth - 1);
+            threadBoard.unmakeMove(moves[i]);
+        }
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> pool;
+    for (unsigned int i=0; i<std::max(1u, threads); i++) {
+        pool.emplace_back(worker);
+    }
+    for (std::thread& th : pool) {
+        th.join();
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+
+    uint64_t nodes = 0;
+    for (int i=0; i<moves.size(); i++) {
+        nodes += counts[i];
+        if (verbose) {
+            std::cout << chess::uci::moveToUci(moves[i]) << ": " << counts[i] << std::endl;
+        }
+    }
+    if (verbose) {
+        std::cout << "\nNodes searched: " << nodes << std::endl;
+        std::cout << "Time (ms): " << elapsed << std::endl;
+        std::cout << "Nodes/second: " << (nodes * 1000 / std::max<int64_t>(elapsed, 1)) << std::endl;
+    }
+    return nodes;
+}
+
+bool PerftSuite(unsigned int threads) {
+    int failed = 0;
+    int count = sizeof(PERFT_SUITE) / sizeof(PERFT_SUITE[0]);
+    auto start = std::chrono::steady_clock::now();
+    for (int i=0; i<count; i++) {
+        const PerftPosition& pos = PERFT_SUITE[i];
+        uint64_t nodes = PerftDivide(chess::Board(pos.fen), pos.depth, threads, false);
+        bool ok = nodes == pos.nodes;
+        if (!ok) {
+            failed++;
+        }
+        std::cout << (ok ? "OK   " : "FAIL ") << pos.fen << " depth " << pos.depth 
+                  << " expected " << pos.nodes << " got " << nodes << std::endl;
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "\n" << (count - failed) << "/" << count << " positions passed in " << elapsed << " ms" << std::endl;
+    return failed == 0;
+}
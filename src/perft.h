@@ -0,0 +1,26 @@
+#ifndef PERFT_H
+#define PERFT_H
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "chess.hpp"
+
+// Number of threads used by perft when none is given
+unsigned int DefaultPerftThreads();
+
+// Counts the leaf nodes of the legal move tree to a given depth
+uint64_t Perft(chess::Board& board, int depth);
+
+// Splits the root moves across threads, prints the leaf count below every 
+// root move followed by the total, time and nodes per second
+uint64_t PerftDivide(const chess::Board& board, int depth, unsigned int threads, bool verbose);
+
+// Runs perft on a set of standard positions with known leaf counts
+// Returns false if any of them does not match
+bool PerftSuite(unsigned int threads);
+
+#endif
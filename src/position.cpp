@@ -0,0 +1,129 @@
+#include "position.h"
+
+// Random keys of the pawns on every square, indexed by chess::Piece
+/* chess::Board does not expose its own zobrist keys, so the pawn key uses 
+    a separate set, generated with splitmix64 from a fixed seed. */
+uint64_t PAWN_KEYS[12][64];
+
+struct PawnKeysInit {
+    PawnKeysInit() {
+        uint64_t seed = 0x9E3779B97F4A7C15ULL;
+        for (int piece=0; piece<12; piece++) {
+            for (int sq=0; sq<64; sq++) {
+                uint64_t z = (seed += 0x9E3779B97F4A7C15ULL);
+                z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+                z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+                PAWN_KEYS[piece][sq] = z ^ (z >> 31);
+            }
+        }
+    }
+} pawnKeysInit;
+
+Position::Position(std::string_view fen) : chess::Board(fen) {
+    refresh();
+}
+
+Position::Position(const chess::Board& board) : chess::Board(board) {
+    refresh();
+}
+
+void Position::setFen(std::string_view fen) {
+    nnue = false; // setting up the board places pieces without accumulators
+    chess::Board::setFen(fen);
+    refresh();
+}
+
+void Position::placePiece(chess::Piece piece, chess::Square sq) {
+    chess::Board::placePiece(piece, sq);
+    psq[piece.color()] += PSQT[piece][sq.index()];
+    if (piece.type() == chess::PieceType::PAWN) {
+        pawnKey_ ^= PAWN_KEYS[piece][sq.index()];
+    }
+    if (nnue && !restoring) {
+        updateFeatures(piece, sq, true);
+    }
+}
+
+void Position::removePiece(chess::Piece piece, chess::Square sq) {
+    chess::Board::removePiece(piece, sq);
+    psq[piece.color()] -= PSQT[piece][sq.index()];
+    if (piece.type() == chess::PieceType::PAWN) {
+        pawnKey_ ^= PAWN_KEYS[piece][sq.index()];
+    }
+    if (nnue && !restoring) {
+        updateFeatures(piece, sq, false);
+    }
+}
+
+// Kings are not inputs. The side whose king moves is refreshed at the end 
+// of makeMove, so only the other side is updated.
+void Position::updateFeatures(chess::Piece piece, chess::Square sq, bool add) {
+    if (piece.type() == chess::PieceType::KING) {
+        return;
+    }
+    Accumulator& acc = accumulators[accPly];
+    for (chess::Color perspective : {chess::Color::WHITE, chess::Color::BLACK}) {
+        if (int(perspective) == kingMoving) {
+            continue;
+        }
+        int index = FeatureIndex(perspective, kingSq(perspective), piece, sq);
+        if (add) {
+            AddFeature(acc, perspective, index);
+        } else {
+            SubFeature(acc, perspective, index);
+        }
+    }
+}
+
+void Position::makeMove(const chess::Move move) {
+    if (!nnue) {
+        chess::Board::makeMove(move);
+        return;
+    }
+    if (accumulators.size() == accPly + 1) {
+        accumulators.emplace_back();
+    }
+    accumulators[accPly + 1] = accumulators[accPly];
+    accPly++;
+    chess::Color us = sideToMove();
+    kingMoving = at<chess::PieceType>(move.from()) == chess::PieceType::KING ? int(us) : -1;
+    chess::Board::makeMove(move);
+    if (kingMoving != -1) {
+        RefreshAccumulator(*this, us, accumulators[accPly]);
+        kingMoving = -1;
+    }
+}
+
+void Position::unmakeMove(const chess::Move move) {
+    if (!nnue) {
+        chess::Board::unmakeMove(move);
+        return;
+    }
+    restoring = true;
+    chess::Board::unmakeMove(move);
+    restoring = false;
+    accPly--;
+}
+
+void Position::refresh() {
+    nnue = UsingNNUE();
+    restoring = false;
+    kingMoving = -1;
+    accPly = 0;
+    if (nnue) {
+        accumulators.resize(1);
+        RefreshAccumulator(*this, chess::Color::WHITE, accumulators[0]);
+        RefreshAccumulator(*this, chess::Color::BLACK, accumulators[0]);
+    }
+    psq[0] = psq[1] = S(0, 0);
+    pawnKey_ = 0;
+    for (int sq=0; sq<64; sq++) {
+        chess::Piece piece = at(chess::Square(sq));
+        if (piece != chess::Piece::NONE) {
+            psq[piece.color()] += PSQT[piece][sq];
+            if (piece.type() == chess::PieceType::PAWN) {
+                pawnKey_ ^= PAWN_KEYS[piece][sq];
+            }
+        }
+    }
+}
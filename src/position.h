@@ -0,0 +1,69 @@
+#ifndef POSITION_H
+#define POSITION_H
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+#include "chess.hpp"
+#include "evaluation.h"
+#include "nnue.h"
+
+// A chess::Board that keeps evaluation terms up to date as moves are made
+/* Every piece placed or removed by makeMove/unmakeMove adds or subtracts 
+    its material and piece-square value from a running middlegame and 
+    endgame Score per color, so the evaluation never has to walk the piece 
+    bitboards for them. The pawn key is kept the same way. unmakeMove goes 
+    through the same two functions, which undoes the changes. 
+
+    When the NNUE evaluation is in use, the position also keeps one NNUE 
+    accumulator per ply. makeMove copies the accumulator of the parent and 
+    updates it for the pieces that are placed and removed, and unmakeMove 
+    goes back to the parent's accumulator. Whether NNUE is in use is read 
+    when the position is set up, so positions have to be set up again after 
+    the option changes. */
+class Position : public chess::Board {
+    public:
+        explicit Position(std::string_view fen = chess::constants::STARTPOS);
+        explicit Position(const chess::Board& board);
+
+        void setFen(std::string_view fen) override;
+
+        // Material and piece-square score of a color, as material_count() computes it
+        Score psqScore(chess::Color c) const { return psq[c]; }
+        int materialMg(chess::Color c) const { return mg_value(psq[c]); }
+        int materialEg(chess::Color c) const { return eg_value(psq[c]); }
+
+        // Zobrist key of the pawns alone, 0 when there are none
+        uint64_t pawnKey() const { return pawnKey_; }
+
+        // Hide the chess::Board versions to also keep the NNUE accumulators
+        void makeMove(const chess::Move move);
+        void unmakeMove(const chess::Move move);
+
+        // NNUE accumulator of the current position, only valid when NNUE is in use
+        const Accumulator& accumulator() const { return accumulators[accPly]; }
+
+    protected:
+        void placePiece(chess::Piece piece, chess::Square sq) override;
+        void removePiece(chess::Piece piece, chess::Square sq) override;
+
+    private:
+        // Recomputes the scores from scratch
+        void refresh();
+
+        // Includes the king's value, so a color's total can reach about 
+        // 30600 with nine queens, which still fits the int16 halves
+        Score psq[2];
+        uint64_t pawnKey_;
+
+        // Updates the accumulator for a piece placed on or removed from a square
+        void updateFeatures(chess::Piece piece, chess::Square sq, bool add);
+
+        std::vector<Accumulator> accumulators;  // one per ply since the position was set up
+        size_t accPly;
+        bool nnue;                              // the accumulators are kept
+        bool restoring;                         // unmakeMove went back to the parent's accumulator
+        int kingMoving;                         // color whose king makeMove is moving, or -1
+};
+
+#endif
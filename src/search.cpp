@@ -2,6 +2,9 @@
 
 SearchInfo info;
 
+// Search threads, the first one is the main thread
+std::vector<std::unique_ptr<ThreadData>> threads;
+
 // Null Move Pruning Reduction Constant
 /* For a depth of 10, we only search it to depth 8 when null-moving.
     R=2 is commonly accepted as a good reduction to search a null-move. 
@@ -9,33 +12,118 @@ SearchInfo info;
     large, rendering the search ineffective. */
 const int R = 2;
 
+// Late move reductions, by depth and move number
+/* Quiet moves ordered late rarely raise alpha, so they are first searched 
+    to a lower depth and only searched to the full depth if they do. The 
+    later the move and the deeper the node, the larger the reduction. */
+std::array<std::array<int, 64>, 64> MakeReductions() {
+    std::array<std::array<int, 64>, 64> reductions{};
+    for (int depth=1; depth<64; depth++) {
+        for (int moves=1; moves<64; moves++) {
+            reductions[depth][moves] = int(0.75 + std::log(depth) * std::log(moves) / 2.25);
+        }
+    }
+    return reductions;
+}
+
+const std::array<std::array<int, 64>, 64> REDUCTIONS = MakeReductions();
+
+// Aspiration windows
+/* From the second iteration on, the root is searched with a narrow window 
+    around the score of the previous iteration, as most iterations only 
+    change it a little and a narrow window cuts off more of the tree. A 
+    score outside the window is only a bound, so the window is widened on 
+    that side, twice as much each time, and the iteration searched again. */
+const int ASPIRATION_DELTA = 15;
+
+// Adds a bonus or a penalty to the butterfly history and the continuation 
+// histories of a quiet move
+void UpdateQuietHistories(ThreadData& td, SearchStack* ss, chess::Move move, int bonus) {
+    int piece = td.board.at(move.from());
+    int from = move.from().index(), to = move.to().index();
+    UpdateHistory(td.history[td.board.sideToMove()][from][to], bonus);
+    for (int i=1; i<=2; i++) {
+        if ((ss - i)->contHist) {
+            UpdateHistory((*(ss - i)->contHist)[piece][to], bonus);
+        }
+    }
+}
+
+// Rewards a quiet move that caused a beta cutoff
+/* It becomes the first killer move of its ply and the countermove of the 
+    previous move, and its history values rise, while the history values 
+    of the quiet moves searched before it are lowered. Deeper cutoffs 
+    count more. */
+void UpdateQuietStats(ThreadData& td, SearchStack* ss, chess::Move move, int depth, int ply, const chess::Movelist& quietsTried) {
+    if (td.killers[ply][0] != move) {
+        td.killers[ply][1] = td.killers[ply][0];
+        td.killers[ply][0] = move;
+    }
+    if ((ss - 1)->contHist) {
+        td.counterMoves[(ss - 1)->piece][(ss - 1)->move.to().index()] = move;
+    }
+    int bonus = std::min(depth * depth, 1200);
+    UpdateQuietHistories(td, ss, move, bonus);
+    for (chess::Move quiet : quietsTried) {
+        UpdateQuietHistories(td, ss, quiet, -bonus);
+    }
+}
+
+// Records the move made at a ply on the stack, before it is made
+void PushMove(ThreadData& td, SearchStack* ss, chess::Move move) {
+    ss->move = move;
+    ss->piece = td.board.at(move.from());
+    ss->contHist = &td.contHistory[ss->piece][move.to().index()];
+}
+
+// Static evaluation of the thread's position, relative to the side to move
+int StaticEval(ThreadData& td, int alpha, int beta) {
+    int eval;
+    if (!td.evalCache.probe(td.board.hash(), eval)) {
+        bool lazy;
+        eval = evaluate(td.board, td.pawnTable, alpha, beta, lazy);
+        if (lazy) {
+            // Only a bound, which is not worth caching
+            td.lazyEvals++;
+            return eval;
+        }
+        td.evalCache.store(td.board.hash(), eval);
+    }
+#ifdef DEBUG_EVAL
+    assert(eval == evaluate(td.board, td.pawnTable));
+#endif
+    return eval;
+}
+
 // Quiscence Search to avoid the horizon effect
 // Special type of search where only the capture moves are analyzed
-int QuiescenceSearch(chess::Board board, int alpha, int beta) {
+// staticEval is the stand pat score when it is already known from the TT
+int QuiescenceSearch(ThreadData& td, int alpha, int beta, int staticEval = VALUE_NONE) {
     // Search cancelled 
     if (info.stopped) {
         return 0;
     }
 
-    info.nodes++;
-    int stand_pat = evaluate(board);
+    Position& board = td.board;
+    td.nodes.store(td.nodes.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    td.qsNodes++;
+    int stand_pat = staticEval != VALUE_NONE ? staticEval : StaticEval(td, alpha, beta);
     if (stand_pat >= beta) {
         return beta;
     }
     if (alpha < stand_pat) {
         alpha = stand_pat;
     }
-    chess::Movelist moves;
-    chess::movegen::legalmoves<chess::movegen::MoveGenType::CAPTURE>(moves, board);
-    OrderMoves(board, moves, -1);
-    for (chess::Move move : moves) {
+    MovePicker picker(board);
+    chess::Move move;
+    while ((move = picker.next()) != chess::Move::NO_MOVE) {
         // Search cancelled 
         if (info.stopped) {
             return 0;
         }
 
         board.makeMove(move);
-        int score = -QuiescenceSearch(board, -beta, -alpha);
+        int score = -QuiescenceSearch(td, -beta, -alpha);
         board.unmakeMove(move);
         if (score >= beta) {
             return beta;
@@ -48,22 +136,22 @@ int QuiescenceSearch(chess::Board board, int alpha, int beta) {
 }
 
 // NegaMax Search with Alpha-Beta Pruning
-int NegaMax(chess::Board board, int depth, int alpha, int beta, bool allowNull) {
+// ply is the distance from the root, used to prefer shorter mates
+int NegaMax(ThreadData& td, int depth, int ply, int alpha, int beta, bool allowNull) {
     // Search cancelled 
     if (info.stopped) {
         return 0;
     }
 
-    info.nodes++;
+    Position& board = td.board;
+    td.nodes.store(td.nodes.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    SearchStack* ss = &td.stack[ply + 2];
 
     int HashFlag = ALPHA;
-    chess::Move curr_best;
-
-    int ttValue = ProbeHash(board, depth, alpha, beta);
-    if (ttValue != VALUEUNKNOWN) {
-        return ttValue;
-    }
+    chess::Move curr_best = chess::Move::NULL_MOVE;
 
+    // Draws are detected before probing the TT, which also gives the 
+    // prefetch of the TT cluster started by the parent time to complete
     if (board.isRepetition(1)) {
         return 0; // draw
     } 
@@ -73,34 +161,45 @@ int NegaMax(chess::Board board, int depth, int alpha, int beta, bool allowNull)
         }
     }
 
-    if (depth == 0) {
-        int evaluation = QuiescenceSearch(board, alpha, beta);
-        RecordHash(board, depth, evaluation, EXACT, curr_best, info.stopped);
-        return evaluation;
+    // The search stack ends here
+    if (ply >= MAX_PLY) {
+        return StaticEval(td, alpha, beta);
     }
 
-    int ply = info.depth - depth;
-
-    chess::Movelist movelist;
-    chess::movegen::legalmoves(movelist, board);
+    bool ttHit;
+    chess::Move ttMove;
+    int ttEval;
+    int ttValue = ProbeHash(board, depth, alpha, beta, ttHit, ttMove, ttEval);
+    td.ttProbes++;
+    td.ttHits += ttHit;
+    if (ttValue != VALUEUNKNOWN) {
+        return ttValue;
+    }
 
-    if (movelist.size() == 0) {
-        if (board.inCheck()) {
-            return -(MATE_VALUE-ply); // checkmate
-        } else {
-            return 0; // draw
+    if (depth == 0) {
+        // The static eval kept in the TT saves the stand pat evaluation
+        int evaluation = QuiescenceSearch(td, alpha, beta, ttEval);
+        // An eval that was not lazy is in the eval cache now, and is 
+        // stored with the result for the next thread to visit the position
+        if (ttEval == VALUE_NONE) {
+            td.evalCache.probe(board.hash(), ttEval);
         }
+        // The quiescence search fails hard, so a result on the edge of 
+        // the window is only a bound
+        int flag = evaluation <= alpha ? ALPHA : (evaluation >= beta ? BETA : EXACT);
+        RecordHash(board, depth, evaluation, flag, curr_best, ttEval, info.stopped);
+        return evaluation;
     }
 
-    OrderMoves(board, movelist, depth);
-
     // Null Move Pruning
     if (allowNull && depth>R && !board.inCheck()) {
         // Only do null-move pruning in positions with more material. 
         // This is to prevent zugswang.
-        if (material_count(board, chess::Color::WHITE, false) + material_count(board, chess::Color::BLACK, false) > 1800) {
+        if (board.materialMg(chess::Color::WHITE) + board.materialMg(chess::Color::BLACK) > 1800) {
+            *ss = {chess::Move::NULL_MOVE, 0, nullptr};
             board.makeNullMove(); // Making the null-move
-            int eval = -NegaMax(board, depth-R-1, -beta, -beta+1, false);
+            PrefetchHash(board.hash());
+            int eval = -NegaMax(td, depth-R-1, ply+1, -beta, -beta+1, false);
             board.unmakeNullMove(); // Unmaking the null-move
             if (eval >= beta) {
                 return eval; // Cutoff
@@ -108,17 +207,63 @@ int NegaMax(chess::Board board, int depth, int alpha, int beta, bool allowNull)
         }
     }
 
-    for (chess::Move move : movelist) {
+    const PieceToHistory* contHist[2] = {(ss - 1)->contHist, (ss - 2)->contHist};
+    chess::Move counterMove = chess::Move::NO_MOVE;
+    if ((ss - 1)->contHist) {
+        counterMove = td.counterMoves[(ss - 1)->piece][(ss - 1)->move.to().index()];
+    }
+    MovePicker picker(board, ttMove, td.killers[ply], counterMove, &td.history, contHist);
+    bool inCheck = board.inCheck();
+    chess::Move move;
+    chess::Movelist quietsTried;
+    int legalMoves = 0;
+    while ((move = picker.next()) != chess::Move::NO_MOVE) {
         // Search cancelled 
         if (info.stopped) {
             return 0;
         }
 
+        legalMoves++;
+        bool quiet = !board.isCapture(move) && move.typeOf() != chess::Move::PROMOTION;
+        bool refutation = move == td.killers[ply][0] || move == td.killers[ply][1] || move == counterMove;
+        int stat = quiet ? MovePicker::quietScore(board, move, &td.history, contHist) : 0;
+        PushMove(td, ss, move);
         board.makeMove(move);
-        int score = -NegaMax(board, depth-1, -beta, -alpha, info.usingNullMoves);
+        // The child probes the TT first thing, start fetching its cluster now
+        PrefetchHash(board.hash());
+
+        // Late move reductions, not for refutations or moves that give check
+        // Moves with a good history are reduced less, and bad ones more
+        int r = 0;
+        if (depth >= 3 && legalMoves > 3 && quiet && !refutation && !inCheck && !board.inCheck()) {
+            r = REDUCTIONS[std::min(depth, 63)][std::min(legalMoves, 63)] - stat / 8192;
+            r = std::clamp(r, 0, depth - 2);
+        }
+        // Principal Variation Search
+        /* The first move is expected to be the best one, and is searched 
+            with the full window. The others only have to be proved worse, 
+            which a zero window around alpha does more cheaply. A move that 
+            turns out better is searched again with the full window. */
+        int score = 0;
+        bool fullDepth = true;
+        if (r > 0) {
+            score = -NegaMax(td, depth-1-r, ply+1, -alpha-1, -alpha, info.usingNullMoves);
+            fullDepth = score > alpha;
+        }
+        if (fullDepth && legalMoves > 1) {
+            score = -NegaMax(td, depth-1, ply+1, -alpha-1, -alpha, info.usingNullMoves);
+        }
+        if (legalMoves == 1 || (score > alpha && score < beta)) {
+            score = -NegaMax(td, depth-1, ply+1, -beta, -alpha, info.usingNullMoves);
+        }
         board.unmakeMove(move);
         if (score >= beta) {
-            RecordHash(board, depth, beta, BETA, curr_best, info.stopped);
+            td.cutoffs++;
+            td.firstMoveCutoffs += (legalMoves == 1);
+            if (quiet && !info.stopped) {
+                UpdateQuietStats(td, ss, move, depth, ply, quietsTried);
+            }
+            RecordHash(board, depth, beta, BETA, move, ttEval, info.stopped);
             return beta;
         }
         if (score > alpha) {
@@ -129,39 +274,189 @@ int NegaMax(chess::Board board, int depth, int alpha, int beta, bool allowNull)
         if (alpha >= beta) {
             break;
         }
+        if (quiet) {
+            quietsTried.add(move);
+        }
     }
 
-    RecordHash(board, depth, alpha, HashFlag, curr_best, info.stopped); 
+    if (legalMoves == 0) {
+        if (board.inCheck()) {
+            return -(MATE_VALUE-ply); // checkmate
+        } else {
+            return 0; // draw
+        }
+    }
+
+    RecordHash(board, depth, alpha, HashFlag, curr_best, ttEval, info.stopped); 
     return alpha;
 }
 
 // Root call for NegaMax
-chess::Move Search(chess::Board board, int depth) {
+// The score of the returned move is only a bound if it is outside alpha..beta
+/* The root is not stored in the TT, so the best move of the previous 
+    search, pvMove, is searched first. PVS and the aspiration windows 
+    both rely on the first move being the best one. */
+chess::Move Search(ThreadData& td, int depth, int alpha, int beta, chess::Move pvMove) {
+    Position& board = td.board;
+    chess::Movelist movelist;
+    chess::movegen::legalmoves(movelist, board);
     // Look for the best move in the transposition table
+    // It is only played if it is legal, so a hash collision can never produce an illegal move
     chess::Move best_move = GetStoredMove(board, depth, -INT_MAX, INT_MAX);
-    if (best_move != chess::Move::NULL_MOVE) {
+    if (best_move != chess::Move::NULL_MOVE && std::find(movelist.begin(), movelist.end(), best_move) != movelist.end()) {
         return best_move;
     }
     // Call NegaMax for finding best move
-    chess::Movelist movelist;
-    chess::movegen::legalmoves(movelist, board);
-    OrderMoves(board, movelist, -1);
-    best_move = movelist[0];
-    int maxScore = -INT_MAX;
-    for (chess::Move move : movelist) {
+    chess::Move firstMove = pvMove != chess::Move::NO_MOVE ? pvMove : TryGetStoredMove(board);
+    MovePicker picker(board, firstMove, nullptr, chess::Move::NO_MOVE, &td.history, nullptr);
+    SearchStack* ss = &td.stack[2];
+    best_move = picker.next();
+    int legalMoves = 0;
+    for (chess::Move move = best_move; move != chess::Move::NO_MOVE; move = picker.next()) {
         // Search cancelled 
         if (info.stopped) {
             return best_move;
         }
 
+        legalMoves++;
+        PushMove(td, ss, move);
         board.makeMove(move);
-        int score = -NegaMax(board, depth - 1, -INT_MAX, INT_MAX, info.usingNullMoves);
+        PrefetchHash(board.hash());
+        // Principal Variation Search, as in NegaMax
+        int score = 0;
+        if (legalMoves > 1) {
+            score = -NegaMax(td, depth - 1, 1, -alpha - 1, -alpha, info.usingNullMoves);
+        }
+        if (legalMoves == 1 || (score > alpha && score < beta)) {
+            score = -NegaMax(td, depth - 1, 1, -beta, -alpha, info.usingNullMoves);
+        }
         board.unmakeMove(move);
-        best_move.setScore(score);
-        if (score > maxScore && !info.stopped) {
-            maxScore = score;
+        if (info.stopped) {
+            return best_move;
+        }
+        if (legalMoves == 1 || score > alpha) {
             best_move = move;
+            best_move.setScore(score);
+        }
+        if (score > alpha) {
+            alpha = score;
+        }
+        if (alpha >= beta) {
+            break; // fail high, the window will be widened
+        }
+    }
+    return best_move;
+}
+
+// Iterative Deepening
+// Searches the position to increasing depths until max is reached or the 
+// search is stopped, and returns the best move of the last full iteration
+chess::Move IterativeDeepening(ThreadData& td, int max, bool verbose) {
+    chess::Move best_move;
+    chess::Move curr_best;
+    chess::Move pvMove = chess::Move::NO_MOVE; // best move of the last search, even one that failed
+    // Helpers start at different depths, so that they search ahead 
+    // of the main thread and fill the TT with the deeper results
+    int start = 1 + td.id % 4;
+    for (int i=start; i<=max; i++) {
+        // Mate scores change by a ply with every iteration, so they get 
+        // the full window
+        int alpha = -INT_MAX, beta = INT_MAX;
+        int delta = ASPIRATION_DELTA;
+        if (i > start && std::abs(best_move.score()) < MATE_VALUE - MAX_PLY) {
+            alpha = best_move.score() - delta;
+            beta = best_move.score() + delta;
+        }
+        while (true) {
+            curr_best = Search(td, i, alpha, beta, pvMove);
+            if (info.stopped) {
+                break;
+            }
+            pvMove = curr_best;
+            int score = curr_best.score();
+            delta *= 2;
+            if (score <= alpha) {
+                alpha = std::max(score - delta, -MATE_VALUE);
+            } else if (score >= beta) {
+                beta = std::min(score + delta, MATE_VALUE);
+            } else {
+                break;
+            }
+        }
+        if (info.stopped) {
+            break;
+        }
+        best_move = curr_best;
+        if (verbose) {
+            std::cout << "info depth " << i << " nodes " << TotalNodes() << " score cp " << best_move.score() << " pv " << best_move << std::endl;
         }
     }
     return best_move;
+}
+
+void SetThreadCount(int count) {
+    info.threads = std::max(count, 1);
+    threads.clear();
+    for (int i=0; i<info.threads; i++) {
+        threads.push_back(std::make_unique<ThreadData>(i));
+    }
+}
+
+chess::Move StartSearch(const chess::Board& board, int max, bool verbose) {
+    if (threads.empty()) {
+        SetThreadCount(info.threads);
+    }
+    NewSearchGeneration();
+    for (auto& td : threads) {
+        td->board = Position(board);
+        td->nodes = 0;
+        td->ttProbes = 0;
+        td->ttHits = 0;
+        td->pawnTable.probes = 0;
+        td->pawnTable.hits = 0;
+        td->evalCache.probes = 0;
+        td->evalCache.hits = 0;
+        td->lazyEvals = 0;
+        td->cutoffs = 0;
+        td->firstMoveCutoffs = 0;
+        td->qsNodes = 0;
+        td->clearHistory();
+    }
+    std::vector<std::thread> helpers;
+    for (size_t i=1; i<threads.size(); i++) {
+        helpers.emplace_back(IterativeDeepening, std::ref(*threads[i]), max, false);
+    }
+    chess::Move best_move = IterativeDeepening(*threads[0], max, verbose);
+    // The main thread is done, so the helpers can stop as well
+    info.stopped = true;
+    for (std::thread& th : helpers) {
+        th.join();
+    }
+    return best_move;
+}
+
+uint64_t TotalNodes() {
+    uint64_t nodes = 0;
+    for (auto& td : threads) {
+        nodes += td->nodes.load(std::memory_order_relaxed);
+    }
+    return nodes;
+}
+
+SearchStats GetSearchStats() {
+    SearchStats stats;
+    for (auto& td : threads) {
+        stats.nodes += td->nodes.load(std::memory_order_relaxed);
+        stats.ttProbes += td->ttProbes;
+        stats.ttHits += td->ttHits;
+        stats.pawnProbes += td->pawnTable.probes;
+        stats.pawnHits += td->pawnTable.hits;
+        stats.evalProbes += td->evalCache.probes;
+        stats.evalHits += td->evalCache.hits;
+        stats.lazyEvals += td->lazyEvals;
+        stats.cutoffs += td->cutoffs;
+        stats.firstMoveCutoffs += td->firstMoveCutoffs;
+        stats.qsNodes += td->qsNodes;
+    }
+    return stats;
 }
\ No newline at end of file
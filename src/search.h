@@ -1,27 +1,37 @@
 #ifndef SEARCH_H
 #define SEARCH_H
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
 #include "chess.hpp"
 #include "evaluation.h"
+#include "position.h"
+#include "pawns.h"
+#include "evalcache.h"
 #include "ordering.h"
 #include "transposition.h"
 #include "reader.hpp"
 
-const int MATE_VALUE = 25000000;
+const int MATE_VALUE = 32000; // fits the 16-bit TT values
 
 struct SearchInfo {
-    int depth;
-    int nodes;
     int duration;
+    int threads;
     bool infinite;
-    bool stopped;
+    std::atomic<bool> stopped;
     bool usingNullMoves;
     bool useOwnBook;
     
     SearchInfo() {
-        depth = 1000;
-        nodes = 0;
         duration = -1;
+        threads = 1;
         infinite = false;
         stopped = true;
         usingNullMoves = true;
@@ -31,6 +41,92 @@ struct SearchInfo {
 
 extern SearchInfo info;
 
-chess::Move Search(chess::Board board, int depth);
+// Search state of a ply
+/* The stack of a thread is indexed by ply + 2, so that the nodes near the 
+    root can read the two plies before them like any other. */
+struct SearchStack {
+    chess::Move move;           // move made at this ply
+    int piece;                  // piece that made it
+    PieceToHistory* contHist;   // continuation history following it, null for a null move
+};
+
+// State owned by a single search thread
+/* Thread 0 is the main thread, the others are Lazy SMP helpers that 
+    search the same position and share their results through the TT. The 
+    TT is the only structure they share: the pawn table, the eval cache 
+    and the move ordering tables are private to their thread, so they are 
+    read and written without any synchronisation. */
+struct ThreadData {
+    int id;
+    Position board;
+    std::atomic<uint64_t> nodes;
+    uint64_t ttProbes;
+    uint64_t ttHits;
+    PawnTable pawnTable;
+    EvalCache evalCache;
+    uint64_t lazyEvals;         // evaluations that stopped at the lazy margin
+    uint64_t cutoffs;           // beta cutoffs in NegaMax
+    uint64_t firstMoveCutoffs;  // beta cutoffs by the first move searched
+    uint64_t qsNodes;           // nodes of the quiescence search, counted in nodes as well
+    chess::Move killers[MAX_PLY][2];
+    ButterflyHistory history;
+    CounterMoves counterMoves;
+    ContinuationHistory contHistory;
+    SearchStack stack[MAX_PLY + 2];
+
+    ThreadData(int id) : id(id), nodes(0), ttProbes(0), ttHits(0), lazyEvals(0), cutoffs(0), firstMoveCutoffs(0), qsNodes(0) {
+        clearHistory();
+    }
+
+    // Forgets the killers, countermoves and histories, done at the start 
+    // of every search
+    void clearHistory() {
+        for (auto& plyKillers : killers) {
+            plyKillers[0] = plyKillers[1] = chess::Move::NO_MOVE;
+        }
+        for (auto& pieceCounterMoves : counterMoves) {
+            for (chess::Move& counterMove : pieceCounterMoves) {
+                counterMove = chess::Move::NO_MOVE;
+            }
+        }
+        std::memset(history, 0, sizeof(history));
+        std::memset(contHistory, 0, sizeof(contHistory));
+        for (SearchStack& ss : stack) {
+            ss = {chess::Move::NO_MOVE, 0, nullptr};
+        }
+    }
+};
+
+// Statistics summed over all threads
+struct SearchStats {
+    uint64_t nodes = 0;
+    uint64_t ttProbes = 0;
+    uint64_t ttHits = 0;
+    uint64_t pawnProbes = 0;
+    uint64_t pawnHits = 0;
+    uint64_t evalProbes = 0;
+    uint64_t evalHits = 0;
+    uint64_t lazyEvals = 0;
+    uint64_t cutoffs = 0;
+    uint64_t firstMoveCutoffs = 0;
+    uint64_t qsNodes = 0;
+};
+
+chess::Move Search(ThreadData& td, int depth, int alpha, int beta, chess::Move pvMove);
+
+chess::Move IterativeDeepening(ThreadData& td, int max, bool verbose);
+
+// Sets the number of search threads (main thread included)
+void SetThreadCount(int count);
+
+// Searches a position with all threads until max depth is reached by 
+// the main thread or the search is stopped, and returns its best move
+chess::Move StartSearch(const chess::Board& board, int max, bool verbose);
+
+// Nodes searched by all threads since the start of the search
+uint64_t TotalNodes();
+
+// Statistics of the last search, only valid once it has finished
+SearchStats GetSearchStats();
 
-#endif
\ No newline at end of file
+#endif
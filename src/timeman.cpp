@@ -1,6 +1,6 @@
 #include "timeman.h"
 
-int GetThinkingTime(chess::Board board, int wtime, int btime, int winc, int binc, int movesToGo, int outOfBookMoves) {
+int GetThinkingTime(const chess::Board& board, int wtime, int btime, int winc, int binc, int movesToGo, int outOfBookMoves) {
     int timeRemainingMs = board.sideToMove()==chess::Color::WHITE ? wtime : btime;
     int incrementMs = board.sideToMove()==chess::Color::WHITE ? winc : binc;
     
@@ -4,6 +4,6 @@
 #include "chess.hpp"
 #include <cmath>
 
-int GetThinkingTime(chess::Board board, int wtime, int btime, int winc, int binc, int movesToGo, int outOfBookMoves);
+int GetThinkingTime(const chess::Board& board, int wtime, int btime, int winc, int binc, int movesToGo, int outOfBookMoves);
 
 #endif
\ No newline at end of file
@@ -1,31 +1,227 @@
 #include "transposition.h"
 
-int TABLE_SIZE;
-HashEntry *TTable;
+uint64_t TABLE_SIZE; // number of clusters
+HashCluster *TTable = nullptr;
+size_t tableBytes = 0;
 
-void InitTranspositionTable(int sizeMb) {
-    TABLE_SIZE = sizeMb * 1024 * 1024 / sizeof(HashEntry);
-    TTable = new HashEntry[TABLE_SIZE];
+// Large pages
+bool largePagesEnabled = true;
+bool largePagesUsed = false;
+bool tableMapped = false; // allocated with mmap(MAP_HUGETLB)
+const size_t LARGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+// Search generation, stored in 6 bits
+uint8_t generation = 0;
+
+// Checksum of the fields of an entry other than the key
+uint16_t EntryChecksum(uint16_t move, int16_t value, int16_t eval, uint8_t genFlag, uint8_t depth) {
+    uint64_t data = (uint64_t)move 
+                  | (uint64_t)(uint16_t)value << 16 
+                  | (uint64_t)(uint16_t)eval << 32 
+                  | (uint64_t)genFlag << 48 
+                  | (uint64_t)depth << 56;
+    return (data * 0x9E3779B97F4A7C15ULL) >> 48;
+}
+
+// Returns the high 64 bits of a * b
+uint64_t MulHi64(uint64_t a, uint64_t b) {
+#if defined(__SIZEOF_INT128__)
+    return ((unsigned __int128)a * b) >> 64;
+#elif defined(_MSC_VER) && defined(_M_X64)
+    return __umulh(a, b);
+#else
+    uint64_t aLo = (uint32_t)a, aHi = a >> 32, bLo = (uint32_t)b, bHi = b >> 32;
+    uint64_t mid = (aLo * bLo >> 32) + (uint32_t)(aHi * bLo) + aLo * bHi;
+    return aHi * bHi + (aHi * bLo >> 32) + (mid >> 32);
+#endif
+}
+
+// Returns the cluster of a position
+// The high bits of the key pick the cluster (without a slow modulo), 
+// the low 16 bits are stored in the entry
+HashCluster *GetCluster(uint64_t hash) {
+    return &TTable[MulHi64(hash, TABLE_SIZE)];
+}
+
+// Allocates memory for the table
+/* On Linux, large pages are tried first: explicit huge pages if the system 
+    has reserved any, otherwise memory aligned to 2MB with transparent huge 
+    pages requested through madvise. With a table of several GB, normal 4KB 
+    pages cause a TLB miss on nearly every probe. Everywhere else, or if 
+    large pages are disabled, the table is only aligned to a cache line. */
+void *AllocTable(size_t size) {
+    tableMapped = false;
+#if defined(__linux__)
+    if (largePagesEnabled && size >= LARGE_PAGE_SIZE) {
+        size_t rounded = (size + LARGE_PAGE_SIZE - 1) / LARGE_PAGE_SIZE * LARGE_PAGE_SIZE;
+        void *mem = mmap(nullptr, rounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (mem != MAP_FAILED) {
+            tableMapped = true;
+            return mem;
+        }
+        mem = std::aligned_alloc(LARGE_PAGE_SIZE, rounded);
+        if (mem != nullptr) {
+            madvise(mem, rounded, MADV_HUGEPAGE);
+            return mem;
+        }
+    }
+#endif
+#if defined(_WIN32)
+    return _aligned_malloc(size, 64);
+#else
+    return std::aligned_alloc(64, (size + 63) / 64 * 64);
+#endif
+}
+
+void FreeTable(void *mem, size_t size) {
+    if (mem == nullptr) {
+        return;
+    }
+#if defined(__linux__)
+    if (tableMapped) {
+        munmap(mem, (size + LARGE_PAGE_SIZE - 1) / LARGE_PAGE_SIZE * LARGE_PAGE_SIZE);
+        return;
+    }
+#endif
+#if defined(_WIN32)
+    _aligned_free(mem);
+#else
+    std::free(mem);
+#endif
+}
+
+// Checks whether the memory at an address is backed by huge pages
+// Transparent huge pages are only counted once the memory has been touched
+bool BackedByHugePages(const void *mem) {
+#if defined(__linux__)
+    if (tableMapped) {
+        return true;
+    }
+    uintptr_t addr = reinterpret_cast<uintptr_t>(mem);
+    std::ifstream smaps("/proc/self/smaps");
+    std::string line;
+    bool inRegion = false;
+    while (std::getline(smaps, line)) {
+        size_t dash = line.find('-');
+        // Region headers look like "7f12a4000000-7f12e4000000 rw-p ..."
+        if (dash != std::string::npos && dash < line.find(' ') && std::isxdigit(line[0]) && !std::isupper(line[0])) {
+            uintptr_t start = std::stoull(line.substr(0, dash), nullptr, 16);
+            uintptr_t end = std::stoull(line.substr(dash + 1, line.find(' ') - dash - 1), nullptr, 16);
+            inRegion = start <= addr && addr < end;
+        } else if (inRegion && line.rfind("AnonHugePages:", 0) == 0) {
+            return std::stoull(line.substr(14)) > 0;
+        }
+    }
+#endif
+    return false;
+}
+
+// Loads an entry and unpacks it if it holds the position with the given key
+// Returns false for an empty entry, another position, or an entry torn by a concurrent write
+bool LoadEntry(HashEntry& entry, uint64_t hash, HashData& hd) {
+    uint16_t key = entry.key.load(std::memory_order_relaxed);
+    uint16_t move = entry.move.load(std::memory_order_relaxed);
+    int16_t value = entry.value.load(std::memory_order_relaxed);
+    int16_t eval = entry.eval.load(std::memory_order_relaxed);
+    uint8_t genFlag = entry.genFlag.load(std::memory_order_relaxed);
+    uint8_t depth = entry.depth.load(std::memory_order_relaxed);
+    if (depth == 0 || (key ^ EntryChecksum(move, value, eval, genFlag, depth)) != (uint16_t)hash) {
+        return false;
+    }
+    hd.value = value;
+    hd.best = chess::Move(move);
+    hd.depth = depth - 1;
+    hd.flag = genFlag & 0x3;
+    hd.generation = genFlag >> 2;
+    hd.eval = eval;
+    return true;
+}
+
+// Reads the entry for a position
+// Returns false if the position is not in its cluster
+bool ReadEntry(uint64_t hash, HashData& hd) {
+    HashCluster *cluster = GetCluster(hash);
+    for (HashEntry& entry : cluster->entries) {
+        if (LoadEntry(entry, hash, hd)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void InitTranspositionTable(uint64_t sizeMb, int threads) {
+    FreeTable(TTable, tableBytes); // free the previous table when resizing
+    TABLE_SIZE = sizeMb * 1024 * 1024 / sizeof(HashCluster);
+    tableBytes = TABLE_SIZE * sizeof(HashCluster);
+    TTable = static_cast<HashCluster*>(AllocTable(tableBytes));
+    if (TTable == nullptr) {
+        std::cerr << "Failed to allocate " << sizeMb << " MB for the transposition table" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    ClearTranspositionTable(threads);
+    largePagesUsed = BackedByHugePages(TTable);
     return;
 }
 
-void ClearTranspositionTable() {
-    delete[] TTable;
-    TTable = new HashEntry[TABLE_SIZE];
+void SetLargePages(bool enabled) {
+    largePagesEnabled = enabled;
+}
+
+bool UsingLargePages() {
+    return largePagesUsed;
+}
+
+void ClearTranspositionTable(int threads) {
+    // The table is cleared in place, every thread zeroing its own slice
+    /* Memory is only mapped by the OS when it is first written, so on a 
+        freshly allocated table this also spreads the pages over the NUMA 
+        nodes of the clearing threads, instead of putting all of them on 
+        the node of a single thread. An entry with depth 0 is empty. */
+    threads = std::max(threads, 1);
+    uint64_t slice = (TABLE_SIZE + threads - 1) / threads;
+    auto clearSlice = [slice](int i) {
+        uint64_t start = std::min(TABLE_SIZE, i * slice);
+        uint64_t end = std::min(TABLE_SIZE, start + slice);
+        std::memset(static_cast<void*>(&TTable[start]), 0, (end - start) * sizeof(HashCluster));
+    };
+    std::vector<std::thread> workers;
+    for (int i=1; i<threads; i++) {
+        workers.emplace_back(clearSlice, i);
+    }
+    clearSlice(0);
+    for (std::thread& th : workers) {
+        th.join();
+    }
+    generation = 0;
     return;
 }
 
-int ProbeHash(chess::Board board, int depth, int alpha, int beta) {
-    HashEntry *entry = &TTable[board.zobrist() % TABLE_SIZE];
-    if (entry->key == board.zobrist()) {
-        if (entry->depth >= depth) {
-            if (entry->flag == EXACT) {
-                return entry->value;
+void NewSearchGeneration() {
+    generation = (generation + 1) & 0x3F;
+}
+
+void PrefetchHash(uint64_t hash) {
+#if defined(_MSC_VER)
+    _mm_prefetch(reinterpret_cast<const char*>(GetCluster(hash)), _MM_HINT_T0);
+#else
+    __builtin_prefetch(GetCluster(hash));
+#endif
+}
+
+int ProbeHash(const chess::Board& board, int depth, int alpha, int beta, bool& hit, chess::Move& move, int& eval) {
+    HashData entry;
+    hit = ReadEntry(board.hash(), entry);
+    move = hit ? entry.best : chess::Move(chess::Move::NO_MOVE);
+    eval = hit ? entry.eval : VALUE_NONE;
+    if (hit) {
+        if (entry.depth >= depth) {
+            if (entry.flag == EXACT) {
+                return entry.value;
             }
-            if ((entry->flag == ALPHA) && (entry->value <= alpha)) {
+            if ((entry.flag == ALPHA) && (entry.value <= alpha)) {
                 return alpha;
             }
-            if ((entry->flag == BETA) && (entry->value >= beta)) {
+            if ((entry.flag == BETA) && (entry.value >= beta)) {
                 return beta;
             }
         }
@@ -33,32 +229,75 @@ int ProbeHash(chess::Board board, int depth, int alpha, int beta) {
     return VALUEUNKNOWN;
 }
 
-void RecordHash(chess::Board board, int depth, int val, int flag, chess::Move best, bool cancelled) {
+// Writes the result of a search to the cluster of a position
+void StoreEntry(uint64_t hash, int depth, int val, int flag, chess::Move best, int eval) {
+    // Replacement scheme
+    /* An entry already holding this position is overwritten by exact 
+        results, and by bounds that are not much shallower than it, so a 
+        qsearch result cannot throw away a deep bound. Otherwise the entry 
+        with the lowest depth is replaced, where every search that has 
+        passed since an entry was written counts as 8 plies of depth lost. Deep results survive shallow ones, but entries left 
+        over from earlier moves eventually age out. */
+    HashCluster *cluster = GetCluster(hash);
+    HashEntry *replace = &cluster->entries[0];
+    int lowest = INT_MAX;
+    for (HashEntry& entry : cluster->entries) {
+        HashData hd;
+        if (LoadEntry(entry, hash, hd)) {
+            if (flag != EXACT && depth <= hd.depth - 4) {
+                return;
+            }
+            replace = &entry;
+            // Keep the old move and static eval if this search did not find them
+            if (best == chess::Move::NULL_MOVE) {
+                best = hd.best;
+            }
+            if (eval == VALUE_NONE) {
+                eval = hd.eval;
+            }
+            break;
+        }
+        int entryDepth = entry.depth.load(std::memory_order_relaxed);
+        int age = (generation - (entry.genFlag.load(std::memory_order_relaxed) >> 2)) & 0x3F;
+        int worth = entryDepth == 0 ? INT_MIN : entryDepth - 8 * age; // empty entries go first
+        if (worth < lowest) {
+            lowest = worth;
+            replace = &entry;
+        }
+    }
+    // Bounds are clamped to the 16-bit range, which keeps them valid bounds
+    uint16_t move = best.move();
+    int16_t value = std::clamp(val, -INT16_MAX, (int)INT16_MAX);
+    int16_t staticEval = std::clamp(eval, (int)INT16_MIN, (int)INT16_MAX);
+    uint8_t genFlag = generation << 2 | flag;
+    uint8_t storedDepth = std::min(depth, 254) + 1; // deeper results are stored as depth 254
+    replace->key.store((uint16_t)hash ^ EntryChecksum(move, value, staticEval, genFlag, storedDepth), std::memory_order_relaxed);
+    replace->move.store(move, std::memory_order_relaxed);
+    replace->value.store(value, std::memory_order_relaxed);
+    replace->eval.store(staticEval, std::memory_order_relaxed);
+    replace->genFlag.store(genFlag, std::memory_order_relaxed);
+    replace->depth.store(storedDepth, std::memory_order_relaxed);
+}
+
+void RecordHash(const chess::Board& board, int depth, int val, int flag, chess::Move best, int eval, bool cancelled) {
     if (cancelled) {
         return; // don't record anything if search was cancelled
     }
-    HashEntry *entry = &TTable[board.zobrist() % TABLE_SIZE];
-    entry->key = board.zobrist();
-    entry->value = val;
-    entry->flag = flag;
-    entry->depth = depth;
-    entry->best = best;
+    StoreEntry(board.hash(), depth, val, flag, best, eval);
 }
 
-chess::Move GetStoredMove(chess::Board board, int depth, int alpha, int beta) {
-    HashEntry entry = TTable[board.zobrist() % TABLE_SIZE];
+chess::Move GetStoredMove(const chess::Board& board, int depth, int alpha, int beta) {
+    HashData entry;
     chess::Move move;
-    if (entry.flag!=VALUEUNKNOWN && entry.depth>=depth) { // valid node
-        if (entry.key == board.zobrist()) {
-            if (entry.flag == EXACT) {
-                move = entry.best;
-                move.setScore(entry.value);
-                return move;
-            } else if (entry.key == ALPHA) {
-                alpha = std::max(alpha, entry.value);
-            } else {
-                beta = std::max(beta, entry.value);
-            }
+    if (ReadEntry(board.hash(), entry) && entry.depth>=depth) { // valid node
+        if (entry.flag == EXACT) {
+            move = entry.best;
+            move.setScore(entry.value);
+            return move;
+        } else if (entry.flag == ALPHA) {
+            alpha = std::max(alpha, entry.value);
+        } else {
+            beta = std::max(beta, entry.value);
         }
         if (alpha > beta) {
             move = entry.best;
@@ -69,7 +308,83 @@ chess::Move GetStoredMove(chess::Board board, int depth, int alpha, int beta) {
     return chess::Move::NULL_MOVE;
 }
 
-chess::Move TryGetStoredMove(chess::Board board) {
-    HashEntry entry = TTable[board.zobrist() % TABLE_SIZE];
-    return entry.best;
+chess::Move TryGetStoredMove(const chess::Board& board) {
+    HashData entry;
+    if (ReadEntry(board.hash(), entry)) {
+        return entry.best;
+    }
+    return chess::Move::NULL_MOVE;
+}
+
+
+// Contents of a stress test write, all derived from the key and the move
+// A read that mixes the fields of two writes does not match them
+struct StressWrite {
+    int value;
+    int eval;
+    int depth;
+    int flag;
+};
+
+StressWrite MakeStressWrite(uint64_t key, uint16_t move) {
+    uint64_t h = (key ^ move) * 0x9E3779B97F4A7C15ULL;
+    return {int(h >> 16 & 0x7FFF) - 0x4000, int(h >> 32 & 0x7FFF) - 0x4000, int(h >> 48 & 0x7F), int(h >> 56) % 3};
+}
+
+bool StressTranspositionTable(int threads, uint64_t operations) {
+    InitTranspositionTable(1, 1);
+    // The keys fall into two clusters of three entries, so entries are 
+    // replaced all the time and most reads race with a write. Their low 
+    // 16 bits differ, so a matching entry was always written for that key.
+    const int KEYS = 16;
+    uint64_t keys[KEYS];
+    for (int i=0; i<KEYS; i++) {
+        keys[i] = (uint64_t)(i % 2) << 63 | 0x5A5A5A5A0000ULL | (i * 4099 + 1);
+    }
+
+    std::atomic<uint64_t> hits(0), inconsistent(0);
+    auto worker = [&](int id) {
+        std::mt19937_64 rng(id + 1);
+        uint64_t threadHits = 0, threadInconsistent = 0;
+        for (uint64_t i=0; i<operations; i++) {
+            uint64_t r = rng();
+            uint64_t key = keys[r % KEYS];
+            if (r >> 32 & 1) {
+                uint16_t move = r >> 40;
+                if (move == chess::Move::NULL_MOVE) {
+                    move = chess::Move::NO_MOVE; // the null move keeps the stored move
+                }
+                StressWrite w = MakeStressWrite(key, move);
+                StoreEntry(key, w.depth, w.value, w.flag, chess::Move(move), w.eval);
+                continue;
+            }
+            HashData hd;
+            if (ReadEntry(key, hd)) {
+                threadHits++;
+                StressWrite w = MakeStressWrite(key, hd.best.move());
+                if (hd.value != w.value || hd.eval != w.eval || hd.depth != w.depth || hd.flag != w.flag || hd.generation != generation) {
+                    threadInconsistent++;
+                }
+            }
+        }
+        hits += threadHits;
+        inconsistent += threadInconsistent;
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> pool;
+    for (int i=0; i<std::max(threads, 1); i++) {
+        pool.emplace_back(worker, i);
+    }
+    for (std::thread& th : pool) {
+        th.join();
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "Threads             : " << std::max(threads, 1) << std::endl;
+    std::cout << "Operations          : " << operations * std::max(threads, 1) << std::endl;
+    std::cout << "Hits                : " << hits << std::endl;
+    std::cout << "Inconsistent entries: " << inconsistent << std::endl;
+    std::cout << "Time (ms)           : " << elapsed << std::endl;
+    return inconsistent == 0;
 }
\ No newline at end of file
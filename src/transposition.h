@@ -1,34 +1,118 @@
 #ifndef TRANSPOSITION_H
 #define TRANSPOSITION_H
 
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+#if defined(_WIN32)
+#include <malloc.h>
+#endif
+#if defined(_MSC_VER)
+#include <xmmintrin.h>
+#endif
 #include "chess.hpp"
 
 const int VALUEUNKNOWN = -99999999;
 
+// Defaults of the ttstress command, operations are per thread
+const int TT_STRESS_THREADS = 8;
+const uint64_t TT_STRESS_OPERATIONS = 10000000;
+
+// Stored as the static eval when it is not known
+const int VALUE_NONE = INT16_MIN;
+
 enum Flag {
     EXACT,
     ALPHA,
     BETA
 };
 
+// A TT entry is shared by all search threads without locking
+/* Entries are 10 bytes: the low 16 bits of the zobrist key, the move, the 
+    value, the static eval, the generation and flag, and the depth. The 
+    stored key is XOR-ed with a checksum of all the other fields. If two 
+    threads write the same entry at once, a reader can get fields from both 
+    writes, but then the checksum no longer matches and the entry is treated 
+    as a miss instead of returning a corrupt move or score. */
 struct HashEntry {
-    uint64_t key;
-    int depth; 
-    int flag;
+    std::atomic<uint16_t> key;      // low 16 bits of the zobrist key ^ checksum
+    std::atomic<uint16_t> move;
+    std::atomic<int16_t> value;
+    std::atomic<int16_t> eval;      // static eval, VALUE_NONE if unknown
+    std::atomic<uint8_t> genFlag;   // generation (6 bits) << 2 | flag (2 bits)
+    std::atomic<uint8_t> depth;     // depth + 1, 0 for an empty entry
+};
+
+// Entries are grouped in 32 byte clusters of three, aligned so that a 
+// probe only touches a single cache line. A position can be stored in 
+// any entry of its cluster.
+const int CLUSTER_SIZE = 3;
+
+struct alignas(32) HashCluster {
+    HashEntry entries[CLUSTER_SIZE];
+    char padding[2];
+};
+
+static_assert(sizeof(HashEntry) == 10, "HashEntry must be 10 bytes");
+static_assert(sizeof(HashCluster) == 32, "HashCluster must be 32 bytes");
+
+// Unpacked contents of a HashEntry
+struct HashData {
     int value;
-    chess::Move best = chess::Move::NULL_MOVE;
+    chess::Move best;
+    int depth;
+    int flag;
+    int generation;
+    int eval;
 };
 
-void InitTranspositionTable(int sizeMb);
+// Allocates a table of the given size, replacing the current one, 
+// and clears it with the given number of threads
+void InitTranspositionTable(uint64_t sizeMb, int threads);
+
+// Enables or disables large pages for the next allocation of the table
+void SetLargePages(bool enabled);
+
+// Checks whether the current table is actually backed by large pages
+bool UsingLargePages();
+
+void ClearTranspositionTable(int threads);
+
+// Called at the start of every search, entries from older searches 
+// become the first to be replaced
+void NewSearchGeneration();
+
+// Starts loading the cluster of a position into the cache, so that a 
+// later probe for it does not stall on memory
+void PrefetchHash(uint64_t hash);
 
-void ClearTranspositionTable();
+// hit is set if the position was found in the table, move to the best 
+// move stored for it, which may not be legal after a collision, and eval 
+// to its static eval, VALUE_NONE if it is not known
+int ProbeHash(const chess::Board& board, int depth, int alpha, int beta, bool& hit, chess::Move& move, int& eval);
 
-int ProbeHash(chess::Board board, int depth, int alpha, int beta);
+void RecordHash(const chess::Board& board, int depth, int val, int flag, chess::Move best, int eval, bool cancelled);
 
-void RecordHash(chess::Board board, int depth, int val, int flag, chess::Move best, bool cancelled);
+chess::Move GetStoredMove(const chess::Board& board, int depth, int alpha, int beta);
 
-chess::Move GetStoredMove(chess::Board board, int depth, int alpha, int beta);
+chess::Move TryGetStoredMove(const chess::Board& board);
 
-chess::Move TryGetStoredMove(chess::Board board);
+// Stress test of the lock-free entries
+/* Threads write and read a few keys of a small table at random, checking 
+    that every entry read is one that was written as a whole. Returns false 
+    if any entry is inconsistent. The table is replaced by a 1 MB one. */
+bool StressTranspositionTable(int threads, uint64_t operations);
 
-#endif
\ No newline at end of file
+#endif
@@ -14,6 +14,40 @@ Reader::Book book;
 // For Time Management
 int noOfMovesOutOfBook = 1;
 
+// The table and the book are set up by the first command that needs them 
+// instead of at startup, so that "uci" is answered right away
+bool tableAllocated = false;
+bool bookLoaded = false;
+
+// Network file of the EvalFile option
+std::string evalFile = NNUE_DEFAULT_FILE;
+// Whether UseNNUE was set, otherwise an embedded network is turned on
+bool nnueChosen = false;
+
+// Loads the network named by EvalFile, the embedded network stands in for 
+// the default file when that does not exist
+bool LoadEvalFile() {
+    if (LoadNetwork(evalFile)) {
+        return true;
+    }
+    return evalFile == NNUE_DEFAULT_FILE && LoadEmbeddedNetwork();
+}
+
+void PrepareEvaluation() {
+    if (!nnueChosen) {
+        // An embedded network is used by default. Its weights are often copied 
+        // when loaded, which takes too long to do before "uciok"
+        if (HasEmbeddedNetwork() && (NetworkLoaded() || LoadEvalFile())) {
+            SetUseNNUE(true);
+        }
+        nnueChosen = true;
+    }
+}
+
+std::string EvaluationName() {
+    return UsingNNUE() ? std::string("NNUE (") + NNUEKernelName() + ")" : "classical";
+}
+
 // Get a random move from a list of possible moves 
 std::string GetRandomMove(std::vector<std::string> moves) {
     std::random_device rd;
@@ -26,21 +60,35 @@ std::string GetRandomMove(std::vector<std::string> moves) {
 std::string options = 
 "\noption name Hash type spin default 64 min 1 max 33554432\n\
 option name Clear Hash type button\n\
+option name Large Pages type check default true\n\
+option name Threads type spin default 1 min 1 max 1024\n\
 option name NullMove type check default true\n\
-option name OwnBook type check default true";
+option name OwnBook type check default true\n\
+option name EvalFile type string default " + NNUE_DEFAULT_FILE + "\n\
+option name UseNNUE type check default " + (HasEmbeddedNetwork() ? "true" : "false");
 
 // UCI Constructor
 UCI::UCI() {
     wtime = 0;
 }
 
+// Sets up what the search needs, once
+void UCI::prepare() {
+    if (!tableAllocated) {
+        // Use Transposition Table by default with 64MB
+        InitTranspositionTable(TABLE_SIZE_MB, info.threads);
+        tableAllocated = true;
+    }
+    if (!bookLoaded) {
+        // Init Polyglot Opening Book 
+        book.Load(path);
+        bookLoaded = true;
+    }
+    PrepareEvaluation();
+}
+
 // UCI Loop Method
 void UCI::loop() {
-    // Use Transposition Table by default with 64MB
-    InitTranspositionTable(TABLE_SIZE_MB);
-    // Init Polyglot Opening Book 
-    book.Load(path);
-
     std::string line;
     std::string token;
     std::cout.setf(std::ios::unitbuf);
@@ -64,18 +112,42 @@ void UCI::loop() {
                     if (name == "value") {
                         is >> std::skipws >> value;
                         TABLE_SIZE_MB = stoi(value);
-                        ClearTranspositionTable();
-                        InitTranspositionTable(TABLE_SIZE_MB);
+                        InitTranspositionTable(TABLE_SIZE_MB, info.threads);
+                        tableAllocated = true;
+                        std::cout << "info string Hash " << TABLE_SIZE_MB << " MB, large pages " << (UsingLargePages() ? "used" : "not used") << std::endl;
                         continue;
                     }
                 } else if (name == "Clear") {
                     is >> std::skipws >> name;
                     if (name == "Hash") {
-                        if (TABLE_SIZE_MB != 0) {
-                            ClearTranspositionTable();
-                            continue;
+                        // A table that is not allocated yet will be clear
+                        if (tableAllocated) {
+                            ClearTranspositionTable(info.threads);
+                        }
+                        continue;
+                    }
+                } else if (name == "Large") {
+                    is >> std::skipws >> name;
+                    if (name == "Pages") {
+                        is >> std::skipws >> name;
+                        if (name == "value") {
+                            is >> std::skipws >> value;
+                            if (value == "true" || value == "false") {
+                                SetLargePages(value == "true");
+                                InitTranspositionTable(TABLE_SIZE_MB, info.threads);
+                                tableAllocated = true;
+                                std::cout << "info string Large pages " << (UsingLargePages() ? "used" : "not used") << std::endl;
+                                continue;
+                            }
                         }
                     }
+                } else if (name == "Threads") {
+                    is >> std::skipws >> name;
+                    if (name == "value") {
+                        is >> std::skipws >> value;
+                        SetThreadCount(stoi(value));
+                        continue;
+                    }
                 } else if (name == "NullMove") {
                     is >> std::skipws >> name;
                     if (name == "value") {
@@ -100,12 +172,50 @@ void UCI::loop() {
                             continue;
                         }
                     }
+                } else if (name == "UseNNUE") {
+                    is >> std::skipws >> name;
+                    if (name == "value") {
+                        is >> std::skipws >> value;
+                        if (value == "true" || value == "false") {
+                            if (value == "true" && !NetworkLoaded() && !LoadEvalFile()) {
+                                std::cout << "info string Could not load the network " << evalFile << std::endl;
+                            }
+                            SetUseNNUE(value == "true");
+                            nnueChosen = true;
+                            // The eval caches hold evaluations of the other evaluation function
+                            SetThreadCount(info.threads);
+                            std::cout << "info string Evaluation " << EvaluationName() << std::endl;
+                            continue;
+                        }
+                    }
+                } else if (name == "EvalFile") {
+                    is >> std::skipws >> name;
+                    if (name == "value") {
+                        // The path is the rest of the line, it can contain spaces
+                        std::getline(is >> std::ws, value);
+                        std::string previous = evalFile;
+                        evalFile = value;
+                        if (LoadEvalFile()) {
+                            SetThreadCount(info.threads); // the eval caches hold evaluations of the previous network
+                            std::cout << "info string Loaded the network " << evalFile << std::endl;
+                        } else {
+                            std::cout << "info string Could not load the network " << evalFile << ", keeping the previous one" << std::endl;
+                            evalFile = previous;
+                        }
+                        continue;
+                    }
                 }
-            } 
+            }
             std::cout << "Unknown option." << std::endl;
         } else if (token == "isready") {
+            prepare();
             std::cout << "readyok" << std::endl;
         } else if (token == "ucinewgame") {
+            // A table that is not allocated yet will be clear
+            if (tableAllocated) {
+                ClearTranspositionTable(info.threads);
+            }
+            prepare();
             board = chess::Board(chess::constants::STARTPOS);
         } else if (token == "position") {
             is >> std::skipws >> token;
@@ -127,13 +237,22 @@ void UCI::loop() {
             }
         } else if (token == "go") {
             if (info.stopped) {
+                // go perft N: count the leaves of the move tree instead of searching
+                std::istringstream peek(line);
+                peek >> token >> token;
+                if (token == "perft") {
+                    int depth = 1;
+                    peek >> std::skipws >> depth;
+                    PerftDivide(board, depth, DefaultPerftThreads(), true);
+                    continue;
+                }
+                prepare();
                 int max = 1000; // default depth
                 info.duration = 0;
                 info.stopped = false;
                 while (is >> std::skipws >> token) {
                     if (token == "depth") {
                         is >> std::skipws >> max;
-                        is >> std::skipws >> info.depth;
                     } else if (token == "wtime") {
                         is >> std::skipws >> wtime;
                     } else if (token == "btime") {
@@ -143,7 +262,6 @@ void UCI::loop() {
                     } else if (token == "infinite") {
                         info.infinite = true;
                         max = 1000;
-                        info.depth = 1000;
                     } else if (token == "movetime") {
                         is >> std::skipws >> info.duration;
                     }
@@ -153,6 +271,22 @@ void UCI::loop() {
             }
         } else if (token == "stop") {
             info.stopped = true;
+        } else if (token == "bench") {
+            if (info.stopped) {
+                int depth = BENCH_DEPTH, hashMb = BENCH_HASH_MB, threads = BENCH_THREADS;
+                is >> std::skipws >> depth >> hashMb >> threads;
+                prepare();
+                Bench(depth, hashMb, threads);
+                InitTranspositionTable(TABLE_SIZE_MB, info.threads); // restore the configured table
+                tableAllocated = true;
+            }
+        } else if (token == "evalbench") {
+            if (info.stopped) {
+                int iterations = EVAL_BENCH_ITERATIONS;
+                is >> std::skipws >> iterations;
+                prepare();
+                EvalBench(iterations);
+            }
         } else if (token == "d") {
             std::cout << board << std::endl;
         } else if (token == "quit") {
@@ -173,7 +307,6 @@ void UCI::findMove(int max) {
             std::string book_move = Reader::ConvertBookMoveToUci(Reader::RandomBookMove(book_moves));
             std::cout << "bestmove " << book_move << std::endl;
             info.stopped = true;
-            info.nodes = 0; 
             noOfMovesOutOfBook = 1; // reset counter if found a book move
             return;
         }
@@ -190,20 +323,12 @@ void UCI::findMove(int max) {
         th2.detach();
     }
     // Normal search
-    chess::Move best_move;
-    chess::Move curr_best;
-    for (int i=1; i<=max; i++) {
-        curr_best = Search(board, i);
-        if (info.stopped) {
-            break;
-        }
-        best_move = curr_best;
-        std::cout << "info depth " << i << " nodes " << info.nodes << " score cp " << best_move.score() / 100 << " pv " << best_move << std::endl;
-    }
+    // Every search thread works on its own copy of the board, which is only 
+    // ever changed through make/unmake and passed down by reference
+    chess::Move best_move = StartSearch(board, max, true);
     std::cout << "bestmove " << chess::uci::moveToUci(best_move) << std::endl;
     noOfMovesOutOfBook++;
     info.stopped = true;
-    info.nodes = 0;
 }
 
 void UCI::timer(int movetime) {
@@ -12,6 +12,12 @@
 #include "chess.hpp"
 #include "transposition.h"
 #include "timeman.h"
+#include "bench.h"
+#include "perft.h"
+
+// Turns on the embedded network unless UseNNUE was set, for the search 
+// and for the command line bench modes
+void PrepareEvaluation();
 
 class UCI {
     unsigned int wtime = 0;
@@ -24,6 +30,7 @@ class UCI {
     public:
         UCI();
         void loop();
+        void prepare();
         void findMove(int max);
         void timer(int milliseconds);
 };